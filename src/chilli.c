@@ -44,6 +44,7 @@ struct app_conn_t *lastusedconn=0;  /* Last used in linked list */
 struct app_conn_t admin_session;
 
 struct timespec mainclock;
+struct timer_wheel chilli_timers;
 time_t checktime;
 time_t rereadtime;
 
@@ -67,6 +68,10 @@ static int acct_req(acct_type type,
 		    struct app_conn_t *conn, 
 		    uint8_t status_type);
 
+static int session_disconnect(struct app_conn_t *appconn,
+			      struct dhcp_conn_t *dhcpconn,
+			      int term_cause);
+
 static pid_t chilli_pid = 0;
 
 #ifdef ENABLE_CHILLIPROXY
@@ -555,6 +560,7 @@ static void set_sessionid(struct app_conn_t *appconn, char full) {
   safe_snprintf(appconn->s_state.sessionid, 
 		sizeof(appconn->s_state.sessionid), 
 		"%.8x%.8x", appconn->rt, appconn->unit);
+  chilli_conn_reindex(appconn);
 
   appconn->s_state.redir.classlen = 0;
   appconn->s_state.redir.statelen = 0;
@@ -879,11 +885,100 @@ static int newip(struct ippoolm_t **ipm, struct in_addr *hisip, uint8_t *hismac)
  * A few functions to manage connections 
  */
 
+static struct app_conn_t **connidx[APPCONN_IDX_MAX];
+static uint32_t connidx_mask;
+
 static int initconn() {
+  uint32_t size;
+  int i;
+
   checktime = rereadtime = mainclock.tv_sec;
+
+  for (size = 16; size < (uint32_t)_options.max_clients; size <<= 1);
+  connidx_mask = size - 1;
+
+  for (i = 0; i < APPCONN_IDX_MAX; i++) {
+    if (!(connidx[i] = calloc(size, sizeof(struct app_conn_t *)))) {
+      log_err(errno, "Out of memory!");
+      return -1;
+    }
+  }
+
   return 0;
 }
 
+static inline uint32_t connidx_ip(uint32_t ip) {
+  return lookup((unsigned char *)&ip, sizeof(ip), 0) & connidx_mask;
+}
+
+static inline uint32_t connidx_nas(uint32_t nasip, uint32_t nasport) {
+  return lookup((unsigned char *)&nasport, sizeof(nasport), nasip) 
+    & connidx_mask;
+}
+
+/* Session ids are compared without case (CoA), so hash them that way */
+static uint32_t connidx_sid(char *sid, size_t len) {
+  uint32_t h = 0;
+  size_t i;
+  for (i = 0; i < len && sid[i]; i++) 
+    h = h * 31 + tolower((unsigned char)sid[i]);
+  return (h ^ (h >> 16)) & connidx_mask;
+}
+
+static void connidx_unlink(struct app_conn_t *conn, int i) {
+  struct app_conn_t **p;
+
+  if (!conn->idx.bucket[i])
+    return;
+
+  for (p = &connidx[i][conn->idx.bucket[i] - 1]; *p; 
+       p = &(*p)->idx.next[i]) {
+    if (*p == conn) {
+      *p = conn->idx.next[i];
+      break;
+    }
+  }
+
+  conn->idx.next[i] = 0;
+  conn->idx.bucket[i] = 0;
+}
+
+static void connidx_link(struct app_conn_t *conn, int i, uint32_t bucket) {
+  conn->idx.next[i] = connidx[i][bucket];
+  connidx[i][bucket] = conn;
+  conn->idx.bucket[i] = bucket + 1;
+}
+
+/**
+ * chilli_conn_reindex()
+ * Files a connection in the hisip, (nasip, nasport) and sessionid
+ * indexes. Must be called whenever one of those keys changes.
+ **/
+void chilli_conn_reindex(struct app_conn_t *conn) {
+  int i;
+
+  if (!connidx[0] || conn->is_adminsession)
+    return;
+
+  for (i = 0; i < APPCONN_IDX_MAX; i++) 
+    connidx_unlink(conn, i);
+
+  if (!conn->inuse)
+    return;
+
+  if (conn->hisip.s_addr)
+    connidx_link(conn, APPCONN_IDX_IP, connidx_ip(conn->hisip.s_addr));
+
+  if (conn->nasip && conn->nasport)
+    connidx_link(conn, APPCONN_IDX_NAS, 
+		 connidx_nas(conn->nasip, conn->nasport));
+
+  if (conn->s_state.sessionid[0])
+    connidx_link(conn, APPCONN_IDX_SID, 
+		 connidx_sid(conn->s_state.sessionid, 
+			     sizeof(conn->s_state.sessionid)));
+}
+
 int chilli_new_conn(struct app_conn_t **conn) {
   int n;
 
@@ -938,6 +1033,8 @@ int chilli_new_conn(struct app_conn_t **conn) {
   
   (*conn)->inuse = 1;
   (*conn)->unit = n;
+
+  session_timer_update(*conn);
   
   return 0; /* Success */
 }
@@ -979,6 +1076,10 @@ int static freeconn(struct app_conn_t *conn) {
     lastusedconn = NULL;
   }
   
+  timer_del(&conn->timer);
+  conn->inuse = 0;
+  chilli_conn_reindex(conn);
+
   /* Initialise structures */
   memset(conn, 0, sizeof(struct app_conn_t));
   conn->unit = n;
@@ -1000,26 +1101,45 @@ int static freeconn(struct app_conn_t *conn) {
 int chilli_getconn(struct app_conn_t **conn, uint32_t ip, 
 		   uint32_t nasip, uint32_t nasport) {
 
-  struct app_conn_t *appconn = firstusedconn;
-
-  while (appconn) {
+  struct app_conn_t *appconn;
 
-    if (!appconn->inuse) {
-      log_err(0, "Connection with inuse == 0!");
+  if (ip) {
+    for (appconn = connidx[APPCONN_IDX_IP][connidx_ip(ip)]; appconn;
+	 appconn = appconn->idx.next[APPCONN_IDX_IP]) {
+      if (appconn->hisip.s_addr == ip) {
+	*conn = appconn;
+	return 0;
+      }
     }
+  }
 
-    if (ip && appconn->hisip.s_addr == ip) {
-      *conn = appconn;
-      return 0;
+  if (nasip && nasport) {
+    for (appconn = connidx[APPCONN_IDX_NAS][connidx_nas(nasip, nasport)]; 
+	 appconn; appconn = appconn->idx.next[APPCONN_IDX_NAS]) {
+      if ((appconn->nasip == nasip) && (appconn->nasport == nasport)) {
+	*conn = appconn;
+	return 0;
+      }
     }
+  }
+
+  return -1; /* Not found */
+}
+
+/**
+ * chilli_getconn_bysid()
+ * Finds a connection by (case insensitive) session id.
+ **/
+int chilli_getconn_bysid(struct app_conn_t **conn, char *sid, size_t len) {
+  struct app_conn_t *appconn;
 
-    if (nasip && nasport &&
-	(appconn->nasip == nasip) && (appconn->nasport == nasport)) {
+  for (appconn = connidx[APPCONN_IDX_SID][connidx_sid(sid, len)]; appconn;
+       appconn = appconn->idx.next[APPCONN_IDX_SID]) {
+    if (strlen(appconn->s_state.sessionid) == len &&
+	!strncasecmp(appconn->s_state.sessionid, sid, len)) {
       *conn = appconn;
       return 0;
     }
-
-    appconn = appconn->next;
   }
 
   return -1; /* Not found */
@@ -1173,9 +1293,94 @@ void session_interval(struct app_conn_t *conn) {
 #endif
 }
 
+/*
+ * Timer callback of a connection, replaces the periodic walk over
+ * all connections.
+ */
+static void session_timer_expire(struct timer_node *t) {
+  struct app_conn_t *conn = timer_entry(t, struct app_conn_t, timer);
+
+  if (!conn->inuse)
+    return;
+
+#ifdef ENABLE_LAYER3
+  if (_options.layer3 &&
+      mainclock_diff(conn->s_state.last_up_time) > 
+      _options.lease + _options.leaseplus) {
+    log_dbg("Session timeout: Removing connection");
+    session_disconnect(conn, 0, RADIUS_TERMINATE_CAUSE_LOST_CARRIER);
+    return;
+  }
+#endif
+
+  if (
+#ifdef ENABLE_LAYER3
+      !_options.layer3 &&
+#endif
+      !conn->dnlink) {
+    log_warn(0, "No downlink protocol");
+  } else {
+    session_interval(conn);
+  }
+
+  if (conn->inuse)
+    session_timer_update(conn);
+}
+
+#define session_timer_min(t) if ((t) < next) next = (t)
+
+/**
+ * session_timer_update()
+ * (Re)arms the timer of a connection for the earliest moment that
+ * session_interval() has something to do. Idle and interim deadlines
+ * only move forward with traffic, so an early expiry just re-arms.
+ * Octet limits are polled every CHECK_INTERVAL, and no connection
+ * waits longer than SESSION_TIMER_MAX to pick up changed parameters.
+ **/
+void session_timer_update(struct app_conn_t *conn) {
+  time_t now = mainclock.tv_sec;
+  time_t next = now + SESSION_TIMER_MAX;
+
+  if (!conn->inuse || conn->is_adminsession)
+    return;
+
+  if (conn->s_state.authenticated == 1) {
+    if (conn->s_params.sessiontimeout)
+      session_timer_min(conn->s_state.start_time + 
+			(time_t)conn->s_params.sessiontimeout + 1);
+    if (conn->s_params.sessionterminatetime)
+      session_timer_min(now + 1 + 
+			(conn->s_params.sessionterminatetime - mainclock_rt()));
+    if (conn->s_params.idletimeout)
+      session_timer_min(conn->s_state.last_up_time + 
+			(time_t)conn->s_params.idletimeout + 1);
+    if (conn->s_params.maxinputoctets ||
+	conn->s_params.maxoutputoctets ||
+	conn->s_params.maxtotaloctets)
+      session_timer_min(now + CHECK_INTERVAL);
+    if (conn->s_params.interim_interval)
+      session_timer_min(conn->s_state.interim_time + 
+			(time_t)conn->s_params.interim_interval);
+  }
+#ifdef ENABLE_GARDENACCOUNTING
+  if (_options.uamgardendata && _options.definteriminterval)
+    session_timer_min(conn->s_state.garden_interim_time + 
+		      (time_t)_options.definteriminterval);
+#endif
+#ifdef ENABLE_LAYER3
+  if (_options.layer3)
+    session_timer_min(conn->s_state.last_up_time + 
+		      _options.lease + _options.leaseplus + 1);
+#endif
+
+  if (next <= now)
+    next = now + 1;
+
+  conn->timer.cb = session_timer_expire;
+  timer_add(&chilli_timers, &conn->timer, next);
+}
+
 static int checkconn() {
-  struct app_conn_t *conn;
-  struct dhcp_conn_t* dhcpconn;
   uint32_t checkdiff;
   uint32_t rereaddiff;
 
@@ -1194,24 +1399,11 @@ static int checkconn() {
 
   checktime = mainclock.tv_sec;
   
+  /* Connections are checked from their timers, see session_timer_update() */
   if (admin_session.s_state.authenticated) {
     session_interval(&admin_session);
   }
 
-  for (conn = firstusedconn; conn; conn=conn->next) {
-    if (conn->inuse != 0) {
-      if (
-#ifdef ENABLE_LAYER3
-	  !_options.layer3 &&
-#endif
-	  !(dhcpconn = (struct dhcp_conn_t *)conn->dnlink)) {
-	log_warn(0, "No downlink protocol");
-	continue;
-      }
-      session_interval(conn);
-    }
-  }
-  
   /* Reread configuration file and recheck DNS */
   if (_options.interval) {
     rereaddiff = mainclock_diffu(rereadtime);
@@ -1799,6 +1991,7 @@ static int acct_req(acct_type type,
       conn->s_state.output_octets = 0;
       break;
     }
+    session_timer_update(conn);
     break;
     
   case RADIUS_STATUS_TYPE_INTERIM_UPDATE:
@@ -2828,24 +3021,21 @@ int cb_redir_getstate(struct redir_t *redir,
    *  Determine if the connection is SSL or not.
    */
   {
-    int n;
-    for (n=0; n < DHCP_DNAT_MAX; n++) {
-      /*
-       *  First, search the dnat list to see if we are tracking the port.
-       */
-      /*log_dbg("%d(%d) == %d",ntohs(dhcpconn->dnat[n].src_port),ntohs(dhcpconn->dnat[n].dst_port),ntohs(address->sin_port));*/
-      if (dhcpconn->dnat[n].src_port == address->sin_port) {
-	if (dhcpconn->dnat[n].dst_port == htons(DHCP_HTTPS) 
+    /*
+     *  First, search the dnat table to see if we are tracking the port.
+     */
+    struct dhcp_nat_t *n = dhcp_dnat_find(dhcpconn, address->sin_addr.s_addr,
+					  address->sin_port);
+    if (n) {
+      if (n->dst_port == htons(DHCP_HTTPS) 
 #ifdef ENABLE_UAMUIPORT
-	    || (_options.uamuissl && dhcpconn->dnat[n].dst_port == htons(_options.uamuiport))
+	  || (_options.uamuissl && n->dst_port == htons(_options.uamuiport))
 #endif
-	    ) {
+	  ) {
 #if(_debug_)
-	  log_dbg("redir connection is SSL");
+	log_dbg("redir connection is SSL");
 #endif
-	  flags |= USING_SSL;
-	}
-	break;
+	flags |= USING_SSL;
       }
     }
 #ifdef ENABLE_UAMUIPORT
@@ -2853,8 +3043,8 @@ int cb_redir_getstate(struct redir_t *redir,
      *  If not in dnat, if uamuissl is enabled, and this is indeed that 
      *  port, then we also know it is SSL (directly to https://uamlisten:uamuiport). 
      */
-    if (n == DHCP_DNAT_MAX && _options.uamuissl && 
-	ntohs(baddress->sin_port) == _options.uamuiport) {
+    else if (_options.uamuissl && 
+	     ntohs(baddress->sin_port) == _options.uamuiport) {
 #if(_debug_)
       log_dbg("redir connection is SSL");
 #endif
@@ -3602,6 +3792,7 @@ int access_request(struct radius_packet_t *pack,
     }
     appconn->nasport = nasportattr->v.i;
   }
+  chilli_conn_reindex(appconn);
 
   /* Store parameters for later use */
   if (uidattr->l-2 < USERNAMESIZE) {
@@ -3833,6 +4024,7 @@ upprot_getip(struct app_conn_t *appconn,
       return dnprot_reject(appconn);
 
     appconn->hisip.s_addr = ipm->addr.s_addr;
+    chilli_conn_reindex(appconn);
     
     if (hismask && hismask->s_addr)
       appconn->hismask.s_addr = hismask->s_addr;
@@ -4201,6 +4393,9 @@ config_radius_session(struct session_params *params,
     params->sessionterminatetime = 0;
 
   session_param_defaults(params);
+
+  if (appconn && params == &appconn->s_params)
+    session_timer_update(appconn);
 }
 
 static int chilliauth_cb(struct radius_t *radius,
@@ -4802,7 +4997,13 @@ int cb_radius_coa_ind(struct radius_t *radius, struct radius_packet_t *pack,
 	  uattr->l-2, uattr->v.t, sattr ? sattr->l-2 : 3, 
 	  sattr ? (char*)sattr->v.t : "all");
   
-  for (appconn = firstusedconn; appconn; appconn = appconn->next) {
+  /* A session-id selects at most one session, use the index */
+  if (!sattr)
+    appconn = firstusedconn;
+  else if (chilli_getconn_bysid(&appconn, (char *)sattr->v.t, sattr->l-2))
+    appconn = 0;
+
+  for (; appconn; appconn = sattr ? 0 : appconn->next) {
 
     if (!appconn->inuse) { log_err(0, "Connection with inuse == 0!"); }
 
@@ -5016,6 +5217,7 @@ int cb_dhcp_request(struct dhcp_conn_t *conn, struct in_addr *addr,
     }
     
     appconn->hisip.s_addr = ipm->addr.s_addr;
+    chilli_conn_reindex(appconn);
     appconn->hismask.s_addr = _options.mask.s_addr;
     
     log(LOG_NOTICE, "Client MAC="MAC_FMT" assigned IP %s" , 
@@ -5181,6 +5383,7 @@ struct app_conn_t * chilli_connect_layer3(struct in_addr *src, struct dhcp_conn_
   
   appconn->s_state.last_up_time = mainclock_now();
   appconn->hisip.s_addr = src->s_addr;
+  chilli_conn_reindex(appconn);
   appconn->hismask.s_addr = _options.mask.s_addr;
   appconn->dnprot = DNPROT_LAYER3;
   appconn->uplink = ipm;
@@ -6113,16 +6316,13 @@ static struct app_conn_t * find_app_conn(struct cmdsock_request *req,
     appconn = (struct app_conn_t *) dhcpconn->peer;
 
   if (!appconn && req->d.sess.sessionid[0] != 0) {
-    struct app_conn_t *aconn = firstusedconn;
+    struct app_conn_t *aconn = 0;
     if (has_criteria)
       *has_criteria = 1;
-    while (aconn) {
-      if (!strcmp(aconn->s_state.sessionid, req->d.sess.sessionid)) {
-	appconn = aconn;
-	break;
-      }
-      aconn = aconn->next;
-    }
+    if (!chilli_getconn_bysid(&aconn, req->d.sess.sessionid,
+			      strlen(req->d.sess.sessionid)) &&
+	!strcmp(aconn->s_state.sessionid, req->d.sess.sessionid))
+      appconn = aconn;
   }
   
   if (appconn && !appconn->inuse) {
@@ -6989,32 +7189,54 @@ int chilli_io(int fd_ctrl_r, int fd_ctrl_w, int fd_pkt_r, int fd_pkt_w) {
 int static redir_msg(struct redir_t *this) {
   struct redir_msg_t msg;
   struct sockaddr_un remote; 
-  socklen_t len = sizeof(remote);
-  int socket = safe_accept(this->msgfd, (struct sockaddr *)&remote, &len);
-  if (socket > 0) {
-    int msgresult = safe_read(socket, &msg, sizeof(msg));
-    if (msgresult == sizeof(msg)) {
-      if (msg.mtype == REDIR_MSG_STATUS_TYPE) {
-	struct redir_conn_t conn;
-	memset(&conn, 0, sizeof(conn));
-	if (cb_redir_getstate(redir, 
-			      &msg.mdata.address, 
-			      &msg.mdata.baddress, 
-			      &conn) != -1) {
-	  if (safe_write(socket, &conn, sizeof(conn)) < 0) {
-	    log_err(errno, "redir_msg writing");
-	  }
-	}
-      } else {
-	uam_msg(&msg);
+  socklen_t len;
+  int i;
+
+  for (i = 0; i < REDIR_MSG_BATCH; i++) {
+    int msgresult;
+
+    len = sizeof(remote);
+    msgresult = safe_recvfrom(this->msgfd, &msg, sizeof(msg), 0,
+			      (struct sockaddr *)&remote, &len);
+
+    if (msgresult == -1) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK)
+	log_err(errno, "redir_msg read");
+      break;
+    }
+
+    if (msgresult != sizeof(msg)) {
+      log_err(0, "invalid size %d", msgresult);
+      continue;
+    }
+
+    if (msg.mtype == REDIR_MSG_STATUS_TYPE) {
+      struct redir_conn_t conn;
+      size_t clen = 0;
+      memset(&conn, 0, sizeof(conn));
+      if (cb_redir_getstate(redir, 
+			    &msg.mdata.address, 
+			    &msg.mdata.baddress, 
+			    &conn) != -1) {
+	clen = sizeof(conn);
+      }
+      /* Always answer, empty when there is no session */
+      if (safe_sendto(this->msgfd, &conn, clen, MSG_DONTWAIT,
+		      (struct sockaddr *)&remote, len) < 0) {
+	log_err(errno, "redir_msg writing");
       }
-    } else if (msgresult == -1) {
-      log_err(errno, "redir_msg read");
     } else {
-      log_err(0, "invalid size %d", msgresult);
+      char ack = 1;
+      uam_msg(&msg);
+      /* Acknowledge senders with an address to answer to */
+      if (len > offsetof(struct sockaddr_un, sun_path) &&
+	  safe_sendto(this->msgfd, &ack, sizeof(ack), MSG_DONTWAIT,
+		      (struct sockaddr *)&remote, len) < 0) {
+	log_err(errno, "redir_msg ack");
+      }
     }
-    safe_close(socket);
   }
+
   return 0;
 }
 #endif
@@ -7073,23 +7295,6 @@ static inline void macauth_reserved() {
   }
 }
 
-#ifdef ENABLE_LAYER3
-static int session_timeout() {
-  struct app_conn_t *conn = firstusedconn;
-
-  while (conn) {
-    struct app_conn_t *check_conn = conn;
-    conn = conn->next;
-    if (mainclock_diff(check_conn->s_state.last_up_time) > 
-	_options.lease + _options.leaseplus) {
-      log_dbg("Session timeout: Removing connection");
-      session_disconnect(check_conn, 0, RADIUS_TERMINATE_CAUSE_LOST_CARRIER);
-    }
-  }
-
-  return 0;
-}
-#endif
 
 int chilli_main(int argc, char **argv) {
   select_ctx sctx;
@@ -7272,6 +7477,7 @@ int chilli_main(int argc, char **argv) {
 #endif
 
   start_tick = mainclock_tick();
+  timer_wheel_init(&chilli_timers, start_tick);
 
   /* Create a tunnel interface */
   if (tun_new(&tun)) {
@@ -7381,8 +7587,15 @@ int chilli_main(int argc, char **argv) {
   
   redir_set(redir, dhcp->rawif[0].hwaddr, (_options.debug));
 
+#ifdef HAVE_SSL
+  /* build the server context (and its ticket keys) before forking */
+  if (_options.uamuissl || _options.redirssl)
+    initssl();
+#endif
+
   /* not really needed for chilliredir */
   redir_set_cb_getstate(redir, cb_redir_getstate);
+  redir->cb_msg = uam_msg;
   
 #ifdef ENABLE_CHILLIQUERY
   if (_options.cmdsocket) {
@@ -7499,6 +7712,13 @@ int chilli_main(int argc, char **argv) {
 		 tun, 0);
 #endif
 
+#if defined(__linux__)
+  for (i=1; i < tun->qcount; i++) 
+    net_select_reg(&sctx, tun->qfd[i],
+		   SELECT_READ, (select_callback) tun_decaps_queue, 
+		   tun, i);
+#endif
+
   net_select_reg(&sctx, selfpipe_init(), 
 		 SELECT_READ, (select_callback)chilli_handle_signal, 
 		 0, 0);
@@ -7550,6 +7770,14 @@ int chilli_main(int argc, char **argv) {
 		   (select_callback)redir_accept, redir, 0);
     net_select_reg(&sctx, redir->fd[1], SELECT_READ, 
 		   (select_callback)redir_accept, redir, 1);
+#ifdef REDIR_POOL
+    if (!_options.redirfork) {
+      int efd = redir_pool_init();
+      if (efd >= 0)
+	net_select_reg(&sctx, efd, SELECT_READ, 
+		       (select_callback)redir_pool_run, redir, 0);
+    }
+#endif
   }
 
 #ifdef ENABLE_MULTIROUTE
@@ -7587,6 +7815,10 @@ int chilli_main(int argc, char **argv) {
       /* Reinit Redir parameters */
       redir_set(redir, dhcp->rawif[0].hwaddr, _options.debug);
 
+#ifdef HAVE_SSL
+      reloadssl();
+#endif
+
 #ifdef HAVE_PATRICIA
       garden_patricia_reload();
 #endif
@@ -7611,13 +7843,8 @@ int chilli_main(int argc, char **argv) {
        */
       radius_timeout(radius);
 
-      if (dhcp) 
-	dhcp_timeout(dhcp);
-
-#ifdef ENABLE_LAYER3
-      if (_options.layer3)
-	session_timeout();
-#endif
+      /* Lease expiry and session timers */
+      timer_wheel_run(&chilli_timers, mainclock.tv_sec);
       
       checkconn();
       lastSecond = mainclock.tv_sec;
@@ -7653,7 +7880,8 @@ int chilli_main(int argc, char **argv) {
     
 #ifdef USING_MMAP
 
-    net_run(&dhcp->rawif[0]);
+    for (i=0; i < MAX_RAWIF && dhcp->rawif[i].fd > 0; i++)
+      net_run(&dhcp->rawif[i]);
 
 #ifdef ENABLE_MULTIROUTE
     if (tun) {
@@ -67,10 +67,23 @@
 #define DEBUG_CONF       16
 
 /* Struct information for each connection */
+/* Secondary lookup indexes of app_conn_t, see chilli_conn_reindex() */
+#define APPCONN_IDX_IP       0  /* hisip */
+#define APPCONN_IDX_NAS      1  /* (nasip, nasport) */
+#define APPCONN_IDX_SID      2  /* s_state.sessionid */
+#define APPCONN_IDX_MAX      3
+
+struct app_conn_idx {
+  struct app_conn_t *next[APPCONN_IDX_MAX]; /* Hash chains */
+  uint32_t bucket[APPCONN_IDX_MAX];         /* Bucket + 1, 0: not indexed */
+};
+
 struct app_conn_t {
   
   struct app_conn_t *next;    /* Next in linked list. 0: Last */
   struct app_conn_t *prev;    /* Previous in linked list. 0: First */
+  struct timer_node timer;    /* Next session_interval() check */
+  struct app_conn_idx idx;    /* Secondary lookup indexes */
 
   /* Pointers to protocol handlers */
   void *uplink;                  /* Uplink network interface (Internet) */
@@ -182,6 +195,7 @@ extern struct app_conn_t *lastusedconn;  /* Last used in linked list */
 extern struct radius_t *radius;          /* Radius client instance */
 extern struct dhcp_t *dhcp;              /* DHCP instance */
 extern struct tun_t *tun;                /* TUN/TAP instance */
+extern struct timer_wheel chilli_timers; /* Lease and session timers */
 
 #ifdef ENABLE_CLUSTER
 struct chilli_peer {
@@ -231,6 +245,8 @@ void chilli_signals(int *with_term, int *with_hup);
 int chilli_binconfig(char *file, size_t flen, pid_t pid);
 
 int chilli_new_conn(struct app_conn_t **conn);
+void chilli_conn_reindex(struct app_conn_t *conn);
+int chilli_getconn_bysid(struct app_conn_t **conn, char *sid, size_t len);
 
 int chilli_assign_snat(struct app_conn_t *appconn, int force);
 
@@ -244,6 +260,7 @@ int chilli_acct_tosub(struct app_conn_t *appconn,
 		      struct pkt_ipphdr_t *ipph);
 
 int terminate_appconn(struct app_conn_t *appconn, int terminate_cause);
+void session_timer_update(struct app_conn_t *conn);
 
 void config_radius_session(struct session_params *params, 
 			   struct radius_packet_t *pack, 
@@ -39,6 +39,8 @@
 #define BUCKET_SIZE_MIN                 7000 /* Minimum size of leaky bucket (~10 packets) */
 
 #define CHECK_INTERVAL                     3 /* Time between checking connections */
+#define GARDEN_DNS_GRACE                 300 /* Seconds a DNS learned garden entry outlives its TTL */
+#define SESSION_TIMER_MAX                 60 /* Max time between session checks */
 
 /* options */
 #define OPT_IPADDRLEN                    256
@@ -49,8 +51,23 @@
 #define REDIR_MAXTIME                    120 /* Seconds */
 #define REDIR_HTTP_MAX_TIME               20 /* Seconds */
 #define REDIR_HTTP_SELECT_TIME             3 /* Seconds */
+#define REDIR_REQUEST_CHUNK               64 /* chilli_redir connections allocated at a time */
+#define REDIR_SSL_SESSIONS              1024 /* TLS sessions cached for resumption */
+#define REDIR_SSL_SESSION_TIME           300 /* Seconds */
+#define REDIR_WWW_INLINE            262144 /* Largest local content served without forking */
+#define REDIR_PROXY_BUFFER             65536 /* Bytes queued each way before a proxy side is paused */
+#define REDIR_INJECT_HEADER            16384 /* Largest upstream header held back for injection */
+#define CONN_POOL_SIZE                    64 /* Idle upstream connections kept for reuse */
+#define CONN_POOL_IDLE                    10 /* Seconds */
+#define CONN_DNS_CACHE                   256 /* Resolved hostnames cached */
+#define CONN_DNS_RETRY                     2 /* Seconds between resolver retries */
+#define CONN_DNS_TRIES                     3
+#define CONN_DNS_MAXTTL                  300 /* Seconds */
+#define CONN_DNS_NEGTTL                   30 /* Seconds */
 #define REDIR_RADIUS_MAX_TIME             60 /* Seconds */
 #define REDIR_RADIUS_SELECT_TIME      500000 /* microseconds = 0.5 seconds */
+#define REDIR_IPC_TIMEOUT                  2 /* Seconds to wait for chilli to answer */
+#define REDIR_MSG_BATCH                   64 /* Messages read from redir per wakeup */
 #define REDIR_CHALLEN                     16
 #define REDIR_MD5LEN                      16
 #define REDIR_MACSTRLEN                   17
@@ -98,6 +115,8 @@
 #define TUN_ADDRSIZE     128
 #define TUN_NLBUFSIZE   1024
 #define TUN_MAX_INTERFACES 32
+#define TUN_READ_BATCH     32 /* Max packets read from tun per wakeup */
+#define TUN_MAX_QUEUES      8
 
 #define TCP_MAX_OPTION_LEN 40
 
@@ -120,6 +139,7 @@
 #define MAX_UAM_DOMAINS                  128 /* Max number of allowed UAM domains */
 #define MACOK_MAX                         56
 #define MAX_SELECT                        56
+#define REDIR_POOL_SIZE                 1024 /* Connections served at once by the in-process redir */
 #define RADIUS_PACKSIZE                 4096
 #else
 #define PKT_MAX_LEN                     5000 /* Maximum packet size we receive */
@@ -130,6 +150,7 @@
 #define MAX_UAM_DOMAINS                   32 /* Max number of allowed UAM domains */
 #define MACOK_MAX                         16
 #define MAX_SELECT                        16
+#define REDIR_POOL_SIZE                  128 /* Connections served at once by the in-process redir */
 #define RADIUS_PACKSIZE                 1600
 #define RADIUS_QUEUE_PACKET_PTR 1
 #endif
@@ -245,6 +245,15 @@ const char *gengetopt_args_info_help[] = {
   "      --ipv6                    Enable IPv6 support  (default=off)",
   "      --ipv6mode=STRING         IPv6 mode is either 6and4 (default), 4to6, or\n                                  6to4",
   "      --ipv6only                Enable IPv6-Only  (default=off)",
+  "      --mmapv3                  Use TPACKET_V3 block based MMAP RX Ring (in\n                                  Linux only)  (default=off)",
+  "      --tunnapi                 Use IFF_NAPI on the tun/tap device (linux only)\n                                  (default=off)",
+  "      --tunqueues=INT           Number of tun/tap queues to open with\n                                  IFF_MULTI_QUEUE, all served by the main\n                                  loop (linux only)  (default=`1')",
+  "      --redirfork               Fork a process for every HTTP connection to the\n                                  redirector instead of serving it in-process\n                                  (default=off)",
+  "      --redirprobe              Answer well-known captive portal detection\n                                  probes with a cached redirect to /prelogin\n                                  (default=off)",
+  "      --redirkeepalive=INT      Seconds an idle persistent HTTP connection to\n                                  chilli_redir is kept open, 0 to close after\n                                  every reply  (default=`15')",
+  "      --redirmaxconn=INT        Maximum number of client connections served at\n                                  once by chilli_redir  (default=`2048')",
+  "      --sslecdsacertfile=STRING SSL ECDSA certificate file in PEM format,\n                                  served next to sslcertfile",
+  "      --sslecdsakeyfile=STRING  SSL ECDSA private key file in PEM format",
     0
 };
 
@@ -508,6 +517,15 @@ void clear_given (struct gengetopt_args_info *args_info)
   args_info->ipv6_given = 0 ;
   args_info->ipv6mode_given = 0 ;
   args_info->ipv6only_given = 0 ;
+  args_info->mmapv3_given = 0 ;
+  args_info->tunnapi_given = 0 ;
+  args_info->tunqueues_given = 0 ;
+  args_info->redirfork_given = 0 ;
+  args_info->redirprobe_given = 0 ;
+  args_info->redirkeepalive_given = 0 ;
+  args_info->redirmaxconn_given = 0 ;
+  args_info->sslecdsacertfile_given = 0 ;
+  args_info->sslecdsakeyfile_given = 0 ;
 }
 
 static
@@ -862,6 +880,20 @@ void clear_args (struct gengetopt_args_info *args_info)
   args_info->ipv6mode_arg = NULL;
   args_info->ipv6mode_orig = NULL;
   args_info->ipv6only_flag = 0;
+  args_info->mmapv3_flag = 0;
+  args_info->tunnapi_flag = 0;
+  args_info->tunqueues_arg = 1;
+  args_info->tunqueues_orig = NULL;
+  args_info->redirfork_flag = 0;
+  args_info->redirprobe_flag = 0;
+  args_info->redirkeepalive_arg = 15;
+  args_info->redirkeepalive_orig = NULL;
+  args_info->redirmaxconn_arg = 2048;
+  args_info->redirmaxconn_orig = NULL;
+  args_info->sslecdsacertfile_arg = NULL;
+  args_info->sslecdsacertfile_orig = NULL;
+  args_info->sslecdsakeyfile_arg = NULL;
+  args_info->sslecdsakeyfile_orig = NULL;
   
 }
 
@@ -1101,6 +1133,15 @@ void init_args_info(struct gengetopt_args_info *args_info)
   args_info->ipv6_help = gengetopt_args_info_help[208] ;
   args_info->ipv6mode_help = gengetopt_args_info_help[209] ;
   args_info->ipv6only_help = gengetopt_args_info_help[210] ;
+  args_info->mmapv3_help = gengetopt_args_info_help[211] ;
+  args_info->tunnapi_help = gengetopt_args_info_help[212] ;
+  args_info->tunqueues_help = gengetopt_args_info_help[213] ;
+  args_info->redirfork_help = gengetopt_args_info_help[214] ;
+  args_info->redirprobe_help = gengetopt_args_info_help[215] ;
+  args_info->redirkeepalive_help = gengetopt_args_info_help[216] ;
+  args_info->redirmaxconn_help = gengetopt_args_info_help[217] ;
+  args_info->sslecdsacertfile_help = gengetopt_args_info_help[218] ;
+  args_info->sslecdsakeyfile_help = gengetopt_args_info_help[219] ;
   
 }
 
@@ -1451,6 +1492,13 @@ cmdline_parser_release (struct gengetopt_args_info *args_info)
   free_multiple_string_field (args_info->extadmvsa_given, &(args_info->extadmvsa_arg), &(args_info->extadmvsa_orig));
   free_string_field (&(args_info->ipv6mode_arg));
   free_string_field (&(args_info->ipv6mode_orig));
+  free_string_field (&(args_info->tunqueues_orig));
+  free_string_field (&(args_info->redirkeepalive_orig));
+  free_string_field (&(args_info->redirmaxconn_orig));
+  free_string_field (&(args_info->sslecdsacertfile_arg));
+  free_string_field (&(args_info->sslecdsacertfile_orig));
+  free_string_field (&(args_info->sslecdsakeyfile_arg));
+  free_string_field (&(args_info->sslecdsakeyfile_orig));
   
   
 
@@ -1901,6 +1949,24 @@ cmdline_parser_dump(FILE *outfile, struct gengetopt_args_info *args_info)
     write_into_file(outfile, "ipv6mode", args_info->ipv6mode_orig, 0);
   if (args_info->ipv6only_given)
     write_into_file(outfile, "ipv6only", 0, 0 );
+  if (args_info->mmapv3_given)
+    write_into_file(outfile, "mmapv3", 0, 0 );
+  if (args_info->tunnapi_given)
+    write_into_file(outfile, "tunnapi", 0, 0 );
+  if (args_info->tunqueues_given)
+    write_into_file(outfile, "tunqueues", args_info->tunqueues_orig, 0);
+  if (args_info->redirfork_given)
+    write_into_file(outfile, "redirfork", 0, 0 );
+  if (args_info->redirprobe_given)
+    write_into_file(outfile, "redirprobe", 0, 0 );
+  if (args_info->redirkeepalive_given)
+    write_into_file(outfile, "redirkeepalive", args_info->redirkeepalive_orig, 0);
+  if (args_info->redirmaxconn_given)
+    write_into_file(outfile, "redirmaxconn", args_info->redirmaxconn_orig, 0);
+  if (args_info->sslecdsacertfile_given)
+    write_into_file(outfile, "sslecdsacertfile", args_info->sslecdsacertfile_orig, 0);
+  if (args_info->sslecdsakeyfile_given)
+    write_into_file(outfile, "sslecdsakeyfile", args_info->sslecdsakeyfile_orig, 0);
   
 
   i = EXIT_SUCCESS;
@@ -2707,6 +2773,15 @@ cmdline_parser_internal (
         { "ipv6",	0, NULL, 0 },
         { "ipv6mode",	1, NULL, 0 },
         { "ipv6only",	0, NULL, 0 },
+        { "mmapv3",	0, NULL, 0 },
+        { "tunnapi",	0, NULL, 0 },
+        { "tunqueues",	1, NULL, 0 },
+        { "redirfork",	0, NULL, 0 },
+        { "redirprobe",	0, NULL, 0 },
+        { "redirkeepalive",	1, NULL, 0 },
+        { "redirmaxconn",	1, NULL, 0 },
+        { "sslecdsacertfile",	1, NULL, 0 },
+        { "sslecdsakeyfile",	1, NULL, 0 },
         { 0,  0, 0, 0 }
       };
 
@@ -5487,6 +5562,124 @@ cmdline_parser_internal (
                 additional_error))
               goto failure;
           
+          }
+          /* Use TPACKET_V3 block based MMAP RX Ring (in Linux only).  */
+          else if (strcmp (long_options[option_index].name, "mmapv3") == 0)
+          {
+          
+          
+            if (update_arg((void *)&(args_info->mmapv3_flag), 0, &(args_info->mmapv3_given),
+                &(local_args_info.mmapv3_given), optarg, 0, 0, ARG_FLAG,
+                check_ambiguity, override, 1, 0, "mmapv3", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Use IFF_NAPI on the tun/tap device (linux only).  */
+          else if (strcmp (long_options[option_index].name, "tunnapi") == 0)
+          {
+          
+          
+            if (update_arg((void *)&(args_info->tunnapi_flag), 0, &(args_info->tunnapi_given),
+                &(local_args_info.tunnapi_given), optarg, 0, 0, ARG_FLAG,
+                check_ambiguity, override, 1, 0, "tunnapi", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Number of tun/tap queues to open with IFF_MULTI_QUEUE (linux only).  */
+          else if (strcmp (long_options[option_index].name, "tunqueues") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->tunqueues_arg), 
+                 &(args_info->tunqueues_orig), &(args_info->tunqueues_given),
+                &(local_args_info.tunqueues_given), optarg, 0, "1", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "tunqueues", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Fork a process for every HTTP connection to the redirector instead of serving it in-process.  */
+          else if (strcmp (long_options[option_index].name, "redirfork") == 0)
+          {
+          
+          
+            if (update_arg((void *)&(args_info->redirfork_flag), 0, &(args_info->redirfork_given),
+                &(local_args_info.redirfork_given), optarg, 0, 0, ARG_FLAG,
+                check_ambiguity, override, 1, 0, "redirfork", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Answer well-known captive portal detection probes with a cached redirect to /prelogin.  */
+          else if (strcmp (long_options[option_index].name, "redirprobe") == 0)
+          {
+          
+          
+            if (update_arg((void *)&(args_info->redirprobe_flag), 0, &(args_info->redirprobe_given),
+                &(local_args_info.redirprobe_given), optarg, 0, 0, ARG_FLAG,
+                check_ambiguity, override, 1, 0, "redirprobe", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Seconds an idle persistent HTTP connection to chilli_redir is kept open, 0 to close after every reply.  */
+          else if (strcmp (long_options[option_index].name, "redirkeepalive") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->redirkeepalive_arg), 
+                 &(args_info->redirkeepalive_orig), &(args_info->redirkeepalive_given),
+                &(local_args_info.redirkeepalive_given), optarg, 0, "15", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "redirkeepalive", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* Maximum number of client connections served at once by chilli_redir.  */
+          else if (strcmp (long_options[option_index].name, "redirmaxconn") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->redirmaxconn_arg), 
+                 &(args_info->redirmaxconn_orig), &(args_info->redirmaxconn_given),
+                &(local_args_info.redirmaxconn_given), optarg, 0, "2048", ARG_INT,
+                check_ambiguity, override, 0, 0,
+                "redirmaxconn", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* SSL ECDSA certificate file in PEM format, served next to sslcertfile.  */
+          else if (strcmp (long_options[option_index].name, "sslecdsacertfile") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->sslecdsacertfile_arg), 
+                 &(args_info->sslecdsacertfile_orig), &(args_info->sslecdsacertfile_given),
+                &(local_args_info.sslecdsacertfile_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "sslecdsacertfile", '-',
+                additional_error))
+              goto failure;
+          
+          }
+          /* SSL ECDSA private key file in PEM format.  */
+          else if (strcmp (long_options[option_index].name, "sslecdsakeyfile") == 0)
+          {
+          
+          
+            if (update_arg( (void *)&(args_info->sslecdsakeyfile_arg), 
+                 &(args_info->sslecdsakeyfile_orig), &(args_info->sslecdsakeyfile_given),
+                &(local_args_info.sslecdsakeyfile_given), optarg, 0, 0, ARG_STRING,
+                check_ambiguity, override, 0, 0,
+                "sslecdsakeyfile", '-',
+                additional_error))
+              goto failure;
+          
           }
           
           break;
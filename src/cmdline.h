@@ -620,6 +620,29 @@ struct gengetopt_args_info
   const char *ipv6mode_help; /**< @brief IPv6 mode is either 6and4 (default), 4to6, or 6to4 help description.  */
   int ipv6only_flag;	/**< @brief Enable IPv6-Only (default=off).  */
   const char *ipv6only_help; /**< @brief Enable IPv6-Only help description.  */
+  int mmapv3_flag;	/**< @brief Use TPACKET_V3 block based MMAP RX Ring (in Linux only) (default=off).  */
+  const char *mmapv3_help; /**< @brief Use TPACKET_V3 block based MMAP RX Ring (in Linux only) help description.  */
+  int tunnapi_flag;	/**< @brief Use IFF_NAPI on the tun/tap device (linux only) (default=off).  */
+  const char *tunnapi_help; /**< @brief Use IFF_NAPI on the tun/tap device (linux only) help description.  */
+  int tunqueues_arg;	/**< @brief Number of tun/tap queues to open with IFF_MULTI_QUEUE, all served by the main loop (linux only) (default='1').  */
+  char * tunqueues_orig;	/**< @brief Number of tun/tap queues to open with IFF_MULTI_QUEUE, all served by the main loop (linux only) original value given at command line.  */
+  const char *tunqueues_help; /**< @brief Number of tun/tap queues to open with IFF_MULTI_QUEUE, all served by the main loop (linux only) help description.  */
+  int redirfork_flag;	/**< @brief Fork a process for every HTTP connection to the redirector instead of serving it in-process (default=off).  */
+  const char *redirfork_help; /**< @brief Fork a process for every HTTP connection to the redirector instead of serving it in-process help description.  */
+  int redirprobe_flag;	/**< @brief Answer well-known captive portal detection probes with a cached redirect to /prelogin (default=off).  */
+  const char *redirprobe_help; /**< @brief Answer well-known captive portal detection probes with a cached redirect to /prelogin help description.  */
+  int redirkeepalive_arg;	/**< @brief Seconds an idle persistent HTTP connection to chilli_redir is kept open, 0 to close after every reply (default='15').  */
+  char * redirkeepalive_orig;	/**< @brief Seconds an idle persistent HTTP connection to chilli_redir is kept open, 0 to close after every reply original value given at command line.  */
+  const char *redirkeepalive_help; /**< @brief Seconds an idle persistent HTTP connection to chilli_redir is kept open, 0 to close after every reply help description.  */
+  int redirmaxconn_arg;	/**< @brief Maximum number of client connections served at once by chilli_redir (default='2048').  */
+  char * redirmaxconn_orig;	/**< @brief Maximum number of client connections served at once by chilli_redir original value given at command line.  */
+  const char *redirmaxconn_help; /**< @brief Maximum number of client connections served at once by chilli_redir help description.  */
+  char * sslecdsacertfile_arg;	/**< @brief SSL ECDSA certificate file in PEM format, served next to sslcertfile.  */
+  char * sslecdsacertfile_orig;	/**< @brief SSL ECDSA certificate file in PEM format, served next to sslcertfile original value given at command line.  */
+  const char *sslecdsacertfile_help; /**< @brief SSL ECDSA certificate file in PEM format, served next to sslcertfile help description.  */
+  char * sslecdsakeyfile_arg;	/**< @brief SSL ECDSA private key file in PEM format.  */
+  char * sslecdsakeyfile_orig;	/**< @brief SSL ECDSA private key file in PEM format original value given at command line.  */
+  const char *sslecdsakeyfile_help; /**< @brief SSL ECDSA private key file in PEM format help description.  */
   
   unsigned int help_given ;	/**< @brief Whether help was given.  */
   unsigned int version_given ;	/**< @brief Whether version was given.  */
@@ -832,6 +855,15 @@ struct gengetopt_args_info
   unsigned int ipv6_given ;	/**< @brief Whether ipv6 was given.  */
   unsigned int ipv6mode_given ;	/**< @brief Whether ipv6mode was given.  */
   unsigned int ipv6only_given ;	/**< @brief Whether ipv6only was given.  */
+  unsigned int mmapv3_given ;	/**< @brief Whether mmapv3 was given.  */
+  unsigned int tunnapi_given ;	/**< @brief Whether tunnapi was given.  */
+  unsigned int tunqueues_given ;	/**< @brief Whether tunqueues was given.  */
+  unsigned int redirfork_given ;	/**< @brief Whether redirfork was given.  */
+  unsigned int redirprobe_given ;	/**< @brief Whether redirprobe was given.  */
+  unsigned int redirkeepalive_given ;	/**< @brief Whether redirkeepalive was given.  */
+  unsigned int redirmaxconn_given ;	/**< @brief Whether redirmaxconn was given.  */
+  unsigned int sslecdsacertfile_given ;	/**< @brief Whether sslecdsacertfile was given.  */
+  unsigned int sslecdsakeyfile_given ;	/**< @brief Whether sslecdsakeyfile was given.  */
 
 } ;
 
@@ -58,14 +58,18 @@ int conn_sock(struct conn_t *conn, struct in_addr *addr, int port) {
   return 0;
 }
 
-int conn_setup(struct conn_t *conn, char *hostname, 
-	       int port, bstring bwrite, bstring bread) {
-  struct hostent *host;
-
+void conn_set_buffers(struct conn_t *conn, bstring bwrite, bstring bread) {
   conn->write_pos = 0;
   conn->write_buf = bwrite;
   conn->read_pos = 0;
   conn->read_buf = bread;
+}
+
+int conn_setup(struct conn_t *conn, char *hostname, 
+	       int port, bstring bwrite, bstring bread) {
+  struct hostent *host;
+
+  conn_set_buffers(conn, bwrite, bread);
 
   if (!(host = gethostbyname(hostname)) || !host->h_addr_list[0]) {
     log_err(0, "Could not resolve IP address of uamserver: %s! [%s]", 
@@ -92,7 +96,7 @@ int conn_fd(struct conn_t *conn,
 }
 
 int conn_select_fd(struct conn_t *conn, select_ctx *sctx) {
-  int evts = SELECT_READ;
+  int evts = conn->paused ? 0 : SELECT_READ;
   if (!conn->sock) return -1;
   if (conn->write_buf &&
       conn->write_pos < conn->write_buf->slen) 
@@ -237,6 +241,423 @@ void conn_set_donehandler(struct conn_t *conn, conn_handler handler, void *ctx)
   conn->done_handler_ctx = ctx;
 }
 
+/*
+ *  Idle upstream connections, kept after a response that was
+ *  completely delimited so the next request to the same server
+ *  can skip the TCP handshake.
+ */
+static struct conn_pool_t {
+  int sock;
+  struct in_addr addr;
+  int port;
+  time_t idle;
+} conn_pool[CONN_POOL_SIZE];
+
+static int conn_alive(int sock) {
+  char c;
+  /* an idle server connection has nothing to read until it closes */
+  return (recv(sock, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 &&
+	  (errno == EWOULDBLOCK || errno == EAGAIN));
+}
+
+int conn_pool_get(struct conn_t *conn, struct in_addr *addr, int port) {
+  time_t now = mainclock_tick();
+  int i;
+
+  for (i=0; i < CONN_POOL_SIZE; i++) {
+    struct conn_pool_t *p = &conn_pool[i];
+    int sock = p->sock;
+
+    if (!sock || p->port != port || 
+	p->addr.s_addr != addr->s_addr)
+      continue;
+
+    p->sock = 0;
+
+    if (now - p->idle > CONN_POOL_IDLE || !conn_alive(sock)) {
+      close(sock);
+      continue;
+    }
+
+#if(_debug_)
+    log_dbg("reusing connection %d to %s:%d", sock, inet_ntoa(*addr), port);
+#endif
+
+    conn->sock = sock;
+    return 1;
+  }
+
+  return 0;
+}
+
+int conn_pool_put(struct conn_t *conn, struct in_addr *addr, int port) {
+  struct conn_pool_t *p = 0;
+  int i;
+
+  if (!conn->sock) return -1;
+#ifdef HAVE_SSL
+  if (conn->sslcon) return -1;
+#endif
+
+  for (i=0; i < CONN_POOL_SIZE; i++) {
+    if (!conn_pool[i].sock) {
+      p = &conn_pool[i];
+      break;
+    }
+    if (!p || conn_pool[i].idle < p->idle)
+      p = &conn_pool[i];
+  }
+
+  if (p->sock) 
+    close(p->sock);
+
+  p->sock = conn->sock;
+  p->addr.s_addr = addr->s_addr;
+  p->port = port;
+  p->idle = mainclock_tick();
+
+  conn->sock = 0;
+  return 0;
+}
+
+void conn_pool_expire() {
+  time_t now = mainclock_tick();
+  int i;
+
+  for (i=0; i < CONN_POOL_SIZE; i++) {
+    if (conn_pool[i].sock && 
+	now - conn_pool[i].idle > CONN_POOL_IDLE) {
+      close(conn_pool[i].sock);
+      conn_pool[i].sock = 0;
+    }
+  }
+}
+
+/*
+ *  A minimal non-blocking stub resolver for A records, so that
+ *  looking up an upstream host does not stall every other
+ *  connection sharing the select loop. Answers, and failures,
+ *  are cached; callers poll conn_dns_resolve() until it settles.
+ */
+#define CONN_DNS_PENDING 1
+#define CONN_DNS_OK      2
+#define CONN_DNS_FAIL    3
+#define CONN_DNS_PROBE   4
+
+static struct conn_dns_t {
+  char name[128];
+  struct in_addr addr;
+  time_t expires;
+  time_t sent;
+  uint16_t id;
+  uint8_t state;
+  uint8_t tries;
+} conn_dns[CONN_DNS_CACHE];
+
+static int conn_dns_sock = 0;
+static FILE *conn_dns_urandom = 0;
+static struct in_addr conn_dns_ns[2];
+
+static uint32_t conn_dns_hash(char *name) {
+  char lower[sizeof(conn_dns[0].name)];
+  int i;
+  for (i=0; name[i] && i < sizeof(lower) - 1; i++)
+    lower[i] = tolower((unsigned char) name[i]);
+  return lookup((uint8_t *)lower, i, 0);
+}
+
+static int conn_dns_query(struct conn_dns_t *e) {
+  uint8_t q[12 + sizeof(e->name) + 2 + 4];
+  struct sockaddr_in ns;
+  char *name = e->name;
+  int len = 12;
+
+  /* the transaction id is all that stands between us and a spoofed answer */
+  if (fread(&e->id, 1, sizeof(e->id), conn_dns_urandom) != sizeof(e->id)) {
+    log_err(errno, "fread() failed");
+    return -1;
+  }
+
+  memset(q, 0, 12);
+  q[0] = e->id >> 8;
+  q[1] = e->id & 0xff;
+  q[2] = 0x01;  /* recursion desired */
+  q[5] = 1;     /* one question */
+
+  while (*name) {
+    char *dot = strchr(name, '.');
+    int l = dot ? dot - name : strlen(name);
+    if (l < 1 || l > 63) return -1;
+    q[len++] = l;
+    memcpy(q + len, name, l);
+    len += l;
+    name += l;
+    if (*name) name++;
+  }
+  q[len++] = 0;
+  q[len++] = 0; q[len++] = 1;  /* A */
+  q[len++] = 0; q[len++] = 1;  /* IN */
+
+  memset(&ns, 0, sizeof(ns));
+  ns.sin_family = AF_INET;
+  ns.sin_port = htons(DHCP_DNS);
+  ns.sin_addr = conn_dns_ns[0];
+  if ((e->tries & 1) && conn_dns_ns[1].s_addr)
+    ns.sin_addr = conn_dns_ns[1];
+
+  e->tries++;
+  e->sent = mainclock_tick();
+
+  if (safe_sendto(conn_dns_sock, q, len, 0, 
+		  (struct sockaddr *)&ns, sizeof(ns)) < 0) {
+    log_err(errno, "sendto(%s) failed", inet_ntoa(ns.sin_addr));
+    return -1;
+  }
+
+  return 0;
+}
+
+int conn_dns_init(struct in_addr *dns1, struct in_addr *dns2) {
+  conn_dns_ns[0] = *dns1;
+  conn_dns_ns[1] = *dns2;
+
+  if (!conn_dns_ns[0].s_addr) 
+    conn_dns_ns[0] = conn_dns_ns[1];
+
+  if (!conn_dns_ns[0].s_addr) {
+    log_warn(0, "no DNS server, resolving upstream hosts synchronously");
+    return 0;
+  }
+
+  if (!conn_dns_urandom &&
+      !(conn_dns_urandom = fopen("/dev/urandom", "r"))) {
+    log_err(errno, "fopen(/dev/urandom, r) failed");
+    return -1;
+  }
+
+  if (!conn_dns_sock) {
+    if ((conn_dns_sock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+      log_err(errno, "socket() failed");
+      conn_dns_sock = 0;
+      return -1;
+    }
+    ndelay_on(conn_dns_sock);
+  }
+
+  return conn_dns_sock;
+}
+
+int conn_dns_fd() {
+  return conn_dns_sock;
+}
+
+int conn_dns_resolve(char *hostname, struct in_addr *addr) {
+  struct conn_dns_t *e = 0;
+  time_t now;
+  uint32_t h;
+  int i;
+
+  if (inet_aton(hostname, addr))
+    return 1;
+
+  if (!conn_dns_sock || !conn_dns_ns[0].s_addr ||
+      strlen(hostname) >= sizeof(e->name)) {
+    struct hostent *host;
+    if (!(host = gethostbyname(hostname)) || !host->h_addr_list[0]) {
+      log_err(0, "Could not resolve IP address of %s! [%s]", 
+	      hostname, strerror(errno));
+      return -1;
+    }
+    memcpy(addr, host->h_addr_list[0], sizeof(*addr));
+    return 1;
+  }
+
+  now = mainclock_tick();
+  h = conn_dns_hash(hostname);
+
+  for (i=0; i < CONN_DNS_PROBE; i++) {
+    struct conn_dns_t *c = &conn_dns[(h + i) % CONN_DNS_CACHE];
+
+    if (c->state && !strcasecmp(c->name, hostname)) {
+      e = c;
+      break;
+    }
+
+    /* otherwise take an empty slot, or the oldest answer */
+    if (!c->state) {
+      if (!e || e->state) e = c;
+    } else if (c->state != CONN_DNS_PENDING) {
+      if (!e || (e->state && c->expires < e->expires)) e = c;
+    }
+  }
+
+  if (!e) 
+    e = &conn_dns[h % CONN_DNS_CACHE];
+
+  if (e->state && !strcasecmp(e->name, hostname)) {
+    switch (e->state) {
+    case CONN_DNS_OK:
+      if (e->expires >= now) {
+	addr->s_addr = e->addr.s_addr;
+	return 1;
+      }
+      break;
+
+    case CONN_DNS_FAIL:
+      if (e->expires >= now)
+	return -1;
+      break;
+
+    case CONN_DNS_PENDING:
+      if (now - e->sent < CONN_DNS_RETRY)
+	return 0;
+      if (e->tries >= CONN_DNS_TRIES) {
+	log_warn(0, "DNS timeout resolving %s", hostname);
+	e->state = CONN_DNS_FAIL;
+	e->expires = now + CONN_DNS_NEGTTL;
+	return -1;
+      }
+      if (conn_dns_query(e)) {
+	e->state = CONN_DNS_FAIL;
+	e->expires = now + CONN_DNS_NEGTTL;
+	return -1;
+      }
+      return 0;
+    }
+  }
+
+  safe_strncpy(e->name, hostname, sizeof(e->name));
+  e->state = CONN_DNS_PENDING;
+  e->tries = 0;
+
+  if (conn_dns_query(e)) {
+    e->state = CONN_DNS_FAIL;
+    e->expires = now + CONN_DNS_NEGTTL;
+    return -1;
+  }
+
+  return 0;
+}
+
+static int conn_dns_skipname(uint8_t *p, int len, int off) {
+  while (off < len) {
+    uint8_t l = p[off];
+    if ((l & 0xC0) == 0xC0) return off + 2;
+    off += l + 1;
+    if (!l) return off;
+  }
+  return -1;
+}
+
+static void conn_dns_answer(uint8_t *p, int len) {
+  struct conn_dns_t *e = 0;
+  char name[sizeof(e->name)];
+  uint16_t id, flags, ancount;
+  time_t now = mainclock_tick();
+  int n = 0, off = 12;
+  uint32_t h;
+  int i;
+
+  if (len < 12) return;
+
+  id = (p[0] << 8) | p[1];
+  flags = (p[2] << 8) | p[3];
+  ancount = (p[6] << 8) | p[7];
+
+  if (!(flags & 0x8000) || p[4] || p[5] != 1) return;
+
+  /* the question is never compressed */
+  while (off < len && p[off]) {
+    int l = p[off++];
+    if (l > 63 || off + l > len || n + l + 1 >= sizeof(name)) return;
+    if (n) name[n++] = '.';
+    memcpy(name + n, p + off, l);
+    n += l;
+    off += l;
+  }
+  name[n] = 0;
+  off += 1 + 4;
+
+  h = conn_dns_hash(name);
+  for (i=0; i < CONN_DNS_PROBE; i++) {
+    struct conn_dns_t *c = &conn_dns[(h + i) % CONN_DNS_CACHE];
+    if (c->state == CONN_DNS_PENDING && c->id == id && 
+	!strcasecmp(c->name, name)) {
+      e = c;
+      break;
+    }
+  }
+
+  if (!e) return;
+
+  e->state = CONN_DNS_FAIL;
+  e->expires = now + CONN_DNS_NEGTTL;
+
+  if (flags & 0x000f) {
+    log_dbg("DNS error %d resolving %s", flags & 0x000f, e->name);
+    return;
+  }
+
+  while (ancount-- > 0 && off < len) {
+    uint16_t type, class, rdlen;
+    uint32_t ttl;
+
+    if ((off = conn_dns_skipname(p, len, off)) < 0 || off + 10 > len)
+      break;
+
+    type = (p[off] << 8) | p[off+1];
+    class = (p[off+2] << 8) | p[off+3];
+    ttl = (p[off+4] << 24) | (p[off+5] << 16) | (p[off+6] << 8) | p[off+7];
+    rdlen = (p[off+8] << 8) | p[off+9];
+    off += 10;
+
+    if (off + rdlen > len) 
+      break;
+
+    if (type == 1 && class == 1 && rdlen == 4) {
+      memcpy(&e->addr.s_addr, p + off, 4);
+      if (ttl > CONN_DNS_MAXTTL) ttl = CONN_DNS_MAXTTL;
+      e->expires = now + ttl;
+      e->state = CONN_DNS_OK;
+#if(_debug_)
+      log_dbg("resolved %s to %s", e->name, inet_ntoa(e->addr));
+#endif
+      return;
+    }
+
+    off += rdlen;
+  }
+
+  log_dbg("no A record for %s", e->name);
+}
+
+int conn_dns_read() {
+  uint8_t p[1500];
+  int cnt = 0;
+  int r;
+
+  if (!conn_dns_sock) return 0;
+
+  while (1) {
+    struct sockaddr_in from;
+    socklen_t fromlen = sizeof(from);
+
+    if ((r = safe_recvfrom(conn_dns_sock, p, sizeof(p), 0, 
+			   (struct sockaddr *)&from, &fromlen)) <= 0)
+      break;
+
+    if (from.sin_port != htons(DHCP_DNS) ||
+	(from.sin_addr.s_addr != conn_dns_ns[0].s_addr &&
+	 from.sin_addr.s_addr != conn_dns_ns[1].s_addr))
+      continue;
+
+    conn_dns_answer(p, r);
+    cnt++;
+  }
+
+  return cnt;
+}
+
 int conn_close(struct conn_t *conn) {
   if (conn->sock) 
     close(conn->sock);
@@ -47,6 +47,7 @@ struct conn_t {
 
   uint8_t connected:1;
   uint8_t error:1;
+  uint8_t paused:1;         /* Do not select for reading */
 
   conn_handler read_handler;
   void * read_handler_ctx;
@@ -60,6 +61,7 @@ void conn_set_readhandler(struct conn_t *conn, conn_handler handler, void *ctx);
 void conn_set_donehandler(struct conn_t *conn, conn_handler handler, void *ctx);
 
 int conn_sock(struct conn_t *conn, struct in_addr *addr, int port);
+void conn_set_buffers(struct conn_t *conn, bstring bwrite, bstring bread);
 int conn_setup(struct conn_t *conn, char *hostname, int port, 
 	       bstring bwrite, bstring bread);
 void conn_finish(struct conn_t *conn);
@@ -73,4 +75,13 @@ int conn_select_fd(struct conn_t *conn, select_ctx *sctx);
 int conn_update_write(struct conn_t *conn);
 int conn_select_update(struct conn_t *conn, select_ctx *sctx);
 
+int conn_pool_get(struct conn_t *conn, struct in_addr *addr, int port);
+int conn_pool_put(struct conn_t *conn, struct in_addr *addr, int port);
+void conn_pool_expire();
+
+int conn_dns_init(struct in_addr *dns1, struct in_addr *dns2);
+int conn_dns_fd();
+int conn_dns_resolve(char *hostname, struct in_addr *addr);
+int conn_dns_read();
+
 #endif
@@ -30,6 +30,8 @@ static uint8_t bmac[PKT_ETH_ALEN] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
 static uint8_t nmac[PKT_ETH_ALEN] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 static int connections = 0;
 
+static void dhcp_dnat_release(struct dhcp_t *this, struct dhcp_conn_t *conn);
+
 extern struct ippool_t *ippool;
 
 struct dhcp_ctx {
@@ -368,17 +370,17 @@ void dhcp_release_mac(struct dhcp_t *this, uint8_t *hwaddr, int term_cause) {
 void dhcp_reset_tcp_mac(struct dhcp_t *this, uint8_t *hwaddr) {
   struct dhcp_conn_t *conn;
   if (!dhcp_hashget(this, &conn, hwaddr)) {
-    int n;
-    for (n=0; n<DHCP_DNAT_MAX; n++) {
-      if (conn->dnat[n].dst_ip) {
-	uint8_t *ip = (uint8_t*)&conn->dnat[n].dst_ip;
+    struct dhcp_nat_t *n;
+    for (n = conn->dnat ? conn->dnat->lru_first : 0; n; n = n->lru_next) {
+      if (n->dst_ip) {
+	uint8_t *ip = (uint8_t*)&n->dst_ip;
 	log_dbg("Resetting dst %d.%d.%d.%d:%d", 
-		ip[0], ip[1], ip[2], ip[3], conn->dnat[n].dst_port);
+		ip[0], ip[1], ip[2], ip[3], n->dst_port);
       }
-      if (conn->dnat[n].src_ip) {
-	uint8_t *ip = (uint8_t*)&conn->dnat[n].src_ip;
+      if (n->src_ip) {
+	uint8_t *ip = (uint8_t*)&n->src_ip;
 	log_dbg("Resetting src %d.%d.%d.%d:%d", 
-		ip[0], ip[1], ip[2], ip[3], conn->dnat[n].src_port);
+		ip[0], ip[1], ip[2], ip[3], n->src_port);
       }
     }
   }
@@ -397,15 +399,19 @@ void dhcp_block_mac(struct dhcp_t *this, uint8_t *hwaddr) {
 int dhcp_net_send(struct _net_interface *netif, unsigned char *hismac, 
 		  uint8_t *packet, size_t length) {
 #if defined(__linux__)
-#ifndef USING_MMAP
-  if (hismac) {
-    netif->dest.sll_halen = PKT_ETH_ALEN;
-    memcpy(netif->dest.sll_addr, hismac, PKT_ETH_ALEN);
-  } else {
-    netif->dest.sll_halen = 0;
-    memset(netif->dest.sll_addr, 0, sizeof(netif->dest.sll_addr));
-  }
+#ifdef USING_MMAP
+  /* The TX ring carries complete frames, only sendto() needs an address */
+  if (!netif->tx_ring.frames)
 #endif
+  {
+    if (hismac) {
+      netif->dest.sll_halen = PKT_ETH_ALEN;
+      memcpy(netif->dest.sll_addr, hismac, PKT_ETH_ALEN);
+    } else {
+      netif->dest.sll_halen = 0;
+      memset(netif->dest.sll_addr, 0, sizeof(netif->dest.sll_addr));
+    }
+  }
   
 #if(_debug_ > 1)
   log_dbg("dhcp_send() len=%d", length);
@@ -451,10 +457,82 @@ int dhcp_send(struct dhcp_t *this, int idx,
 
 /**
  * dhcp_hash()
- * Generates a 32 bit hash based on a mac address
+ * Generates a 64 bit hash based on a mac address. The 48 bit address
+ * is loaded into an integer and mixed with a multiplicative hash; the
+ * top bits select the home slot and the whole value is kept in the
+ * slot as a fingerprint.
  **/
-uint32_t dhcp_hash(uint8_t *hwaddr) {
-  return lookup(hwaddr, PKT_ETH_ALEN, 0);
+static inline uint64_t dhcp_hash(uint8_t *hwaddr) {
+  uint64_t h = ((uint64_t)hwaddr[0] << 40) | ((uint64_t)hwaddr[1] << 32) |
+    ((uint64_t)hwaddr[2] << 24) | ((uint64_t)hwaddr[3] << 16) |
+    ((uint64_t)hwaddr[4] << 8) | (uint64_t)hwaddr[5];
+  h ^= h >> 23;
+  h *= 0x9e3779b97f4a7c15ULL;
+  return h ^ (h >> 29);
+}
+
+#define dhcp_hash_home(this, h) ((int)((h) >> (64 - (this)->hashlog)))
+#define dhcp_hash_dist(this, h, i) \
+  (((i) - dhcp_hash_home((this), (h))) & (this)->hashmask)
+
+static int dhcp_hashalloc(struct dhcp_t *this, int hashlog) {
+  if (hashlog < 4) hashlog = 4;
+
+  if (!(this->hash = calloc(sizeof(struct dhcp_hash_slot), 1 << hashlog))) {
+    /* Failed to allocate memory for hash members */
+    return -1;
+  }
+
+  this->hashlog = hashlog;
+  this->hashsize = 1 << hashlog;
+  this->hashmask = this->hashsize - 1;
+  this->hashcount = 0;
+  return 0;
+}
+
+/*
+ * Robin Hood insert of a slot: an entry further from its home slot
+ * takes the place of one nearer to home, which keeps probe sequences
+ * short and lets lookups stop early.
+ */
+static void dhcp_hashinsert(struct dhcp_t *this, struct dhcp_hash_slot ins) {
+  int i = dhcp_hash_home(this, ins.hash);
+  int dist = 0;
+
+  while (this->hash[i].conn) {
+    int d = dhcp_hash_dist(this, this->hash[i].hash, i);
+    if (d < dist) {
+      struct dhcp_hash_slot tmp = this->hash[i];
+      this->hash[i] = ins;
+      ins = tmp;
+      dist = d;
+    }
+    i = (i + 1) & this->hashmask;
+    dist++;
+  }
+
+  this->hash[i] = ins;
+  this->hashcount++;
+}
+
+static int dhcp_hashgrow(struct dhcp_t *this) {
+  struct dhcp_hash_slot *old = this->hash;
+  int oldsize = this->hashsize;
+  int i;
+
+  if (dhcp_hashalloc(this, this->hashlog + 1)) {
+    this->hash = old;
+    return -1;
+  }
+
+  for (i = 0; i < oldsize; i++)
+    if (old[i].conn)
+      dhcp_hashinsert(this, old[i]);
+
+  free(old);
+
+  log_dbg("hash table grown to %d", this->hashsize);
+  return 0;
 }
 
 /**
@@ -462,21 +540,16 @@ uint32_t dhcp_hash(uint8_t *hwaddr) {
  * Initialises hash tables
  **/
 int dhcp_hashinit(struct dhcp_t *this, int listsize) {
-  /* Determine hashlog */
-  for ((this)->hashlog = 0; 
-       ((1 << (this)->hashlog) < listsize);
-       (this)->hashlog++);
-  
-  /* Determine hashsize */
-  (this)->hashsize = 1 << (this)->hashlog;
-  (this)->hashmask = (this)->hashsize -1;
-  
-  /* Allocate hash table */
-  if (!((this)->hash = 
-	calloc(sizeof(struct dhcp_conn_t *), (this)->hashsize))) {
-    /* Failed to allocate memory for hash members */
+  int hashlog;
+
+  /* Keep the load factor at or below one half */
+  if (listsize < _options.max_clients)
+    listsize = _options.max_clients;
+
+  for (hashlog = 0; ((1 << hashlog) < listsize * 2); hashlog++);
+
+  if (dhcp_hashalloc(this, hashlog))
     return -1;
-  }
   
   log_dbg("hash table size %d (%d)", this->hashsize, listsize);
   return 0;
@@ -488,20 +561,20 @@ int dhcp_hashinit(struct dhcp_t *this, int listsize) {
  * Adds a connection to the hash table
  **/
 int dhcp_hashadd(struct dhcp_t *this, struct dhcp_conn_t *conn) {
-  uint32_t hash;
-  struct dhcp_conn_t *p;
-  struct dhcp_conn_t *p_prev = NULL; 
-
-  /* Insert into hash table */
-  hash = dhcp_hash(conn->hismac) & this->hashmask;
-  for (p = this->hash[hash]; p; p = p->nexthash)
-    p_prev = p;
-  if (!p_prev)
-    this->hash[hash] = conn;
-  else 
-    p_prev->nexthash = conn;
+  struct dhcp_hash_slot ins;
+
+  if ((this->hashcount + 1) * 2 > this->hashsize)
+    if (dhcp_hashgrow(this)) {
+      log_err(0, "Out of memory!");
+      if (this->hashcount + 1 >= this->hashsize)
+	return -1;
+    }
+
+  ins.hash = dhcp_hash(conn->hismac);
+  ins.conn = conn;
+  dhcp_hashinsert(this, ins);
 
-  return 0; /* Always OK to insert */
+  return 0;
 }
 
 
@@ -510,23 +583,31 @@ int dhcp_hashadd(struct dhcp_t *this, struct dhcp_conn_t *conn) {
  * Removes a connection from the hash table
  **/
 int dhcp_hashdel(struct dhcp_t *this, struct dhcp_conn_t *conn) {
-  uint32_t hash;
-  struct dhcp_conn_t *p;
-  struct dhcp_conn_t *p_prev = NULL; 
+  uint64_t hash = dhcp_hash(conn->hismac);
+  int i = dhcp_hash_home(this, hash);
+  int dist = 0;
+  int j;
 
   /* Find in hash table */
-  hash = dhcp_hash(conn->hismac) & this->hashmask;
-  for (p = this->hash[hash]; p; p = p->nexthash) {
-    if (p == conn) {
-      break;
-    }
-    p_prev = p;
+  while (this->hash[i].conn != conn) {
+    if (!this->hash[i].conn ||
+	dhcp_hash_dist(this, this->hash[i].hash, i) < dist)
+      return -1;
+    i = (i + 1) & this->hashmask;
+    dist++;
   }
 
-  if (!p_prev)
-    this->hash[hash] = p->nexthash;
-  else
-    p_prev->nexthash = p->nexthash;
+  /* Backward shift the rest of the cluster, no tombstones needed */
+  for (j = (i + 1) & this->hashmask;
+       this->hash[j].conn && dhcp_hash_dist(this, this->hash[j].hash, j);
+       j = (j + 1) & this->hashmask) {
+    this->hash[i] = this->hash[j];
+    i = j;
+  }
+
+  this->hash[i].conn = NULL;
+  this->hash[i].hash = 0;
+  this->hashcount--;
   
   return 0;
 }
@@ -614,15 +695,21 @@ void dhcp_checktag(struct dhcp_conn_t *conn, uint8_t *pack) {
  **/
 int dhcp_hashget(struct dhcp_t *this, struct dhcp_conn_t **conn, 
 		 uint8_t *hwaddr) {
-  struct dhcp_conn_t *p;
-  uint32_t hash;
+  uint64_t hash = dhcp_hash(hwaddr);
+  int i = dhcp_hash_home(this, hash);
+  int dist = 0;
 
   /* Find in hash table */
-  hash = dhcp_hash(hwaddr) & this->hashmask;
-  for (p = this->hash[hash]; p; p = p->nexthash) {
-    if ((!memcmp(p->hismac, hwaddr, PKT_ETH_ALEN)) && (p->inuse)) {
-      *conn = p;
-      return 0;
+  for (; this->hash[i].conn; i = (i + 1) & this->hashmask, dist++) {
+    struct dhcp_hash_slot *s = &this->hash[i];
+    if (s->hash == hash) {
+      struct dhcp_conn_t *p = s->conn;
+      if ((!memcmp(p->hismac, hwaddr, PKT_ETH_ALEN)) && (p->inuse)) {
+	*conn = p;
+	return 0;
+      }
+    } else if (dhcp_hash_dist(this, s->hash, i) < dist) {
+      break;
     }
   }
   *conn = NULL;
@@ -742,6 +829,7 @@ int dhcp_newconn(struct dhcp_t *this,
   (*conn)->lasttime = mainclock_now();
   
   dhcp_hashadd(this, *conn);
+  dhcp_lease_timer(*conn);
 
 #ifdef ENABLE_LAYER3
   if (_options.layer3) {
@@ -815,6 +903,9 @@ int dhcp_freeconn(struct dhcp_conn_t *conn, int term_cause)
     this->lastusedconn = NULL;
   }
 
+  timer_del(&conn->leasetimer);
+  dhcp_dnat_release(this, conn);
+
   /* Initialise structures */
   memset(conn, 0, sizeof(*conn));
 
@@ -833,28 +924,34 @@ int dhcp_freeconn(struct dhcp_conn_t *conn, int term_cause)
 }
 
 
-/**
- * dhcp_checkconn()
- * Checks connections to see if the lease has expired
- **/
-int dhcp_checkconn(struct dhcp_t *this) {
-  struct dhcp_conn_t *conn = this->firstusedconn;
+/*
+ * Lease expiry timer callback. Traffic only moves lasttime forward, so
+ * a timer that fires early is simply re-armed for the new deadline.
+ */
+static void dhcp_lease_expire(struct timer_node *t) {
+  struct dhcp_conn_t *conn = timer_entry(t, struct dhcp_conn_t, leasetimer);
 
-  while (conn) {
-    /*
-    if (_options.debug)
-      log_dbg("dhcp_checkconn: %d %d", mainclock_diff(conn->lasttime), (int) this->lease);
-    */
-    struct dhcp_conn_t *check_conn = conn;
-    conn = conn->next;
-    if (!check_conn->is_reserved && 
-	mainclock_diff(check_conn->lasttime) > (int)this->lease + _options.leaseplus) {
-      log_dbg("DHCP timeout: Removing connection");
-      dhcp_freeconn(check_conn, RADIUS_TERMINATE_CAUSE_LOST_CARRIER);
-    }
+  if (!conn->inuse || conn->is_reserved)
+    return;
+
+  if (mainclock_diff(conn->lasttime) > 
+      (int)conn->parent->lease + _options.leaseplus) {
+    log_dbg("DHCP timeout: Removing connection");
+    dhcp_freeconn(conn, RADIUS_TERMINATE_CAUSE_LOST_CARRIER);
+    return;
   }
 
-  return 0;
+  dhcp_lease_timer(conn);
+}
+
+/**
+ * dhcp_lease_timer()
+ * (Re)arms the lease expiry timer of a connection
+ **/
+void dhcp_lease_timer(struct dhcp_conn_t *conn) {
+  conn->leasetimer.cb = dhcp_lease_expire;
+  timer_add(&chilli_timers, &conn->leasetimer, conn->lasttime + 
+	    (int)conn->parent->lease + _options.leaseplus + 1);
 }
 
 #ifdef HAVE_NETFILTER_QUEUE
@@ -1208,6 +1305,9 @@ int dhcp_new(struct dhcp_t **pdhcp, int numconn, int hashsize,
   }
 #endif
 
+  garden_dyn_init(dhcp->pass_throughs, MAX_PASS_THROUGHS, 
+		  &dhcp->num_pass_throughs);
+
   return 0;
 }
 
@@ -1387,6 +1487,7 @@ void dhcp_free(struct dhcp_t *dhcp) {
     patricia_destroy (dhcp->ptree_authed, free);
 #endif
 #endif
+  garden_dyn_free(dhcp->pass_throughs);
   if (dhcp->hash) 
     free(dhcp->hash);
   if (!_options.uid)
@@ -1403,28 +1504,28 @@ void dhcp_free(struct dhcp_t *dhcp) {
   for (conn = dhcp->firstusedconn; conn; ) {
     c = conn;
     conn = conn->next;
+    dhcp_dnat_release(dhcp, c);
     free(c);
   }
 
-  free(dhcp);
-}
+  while (dhcp->freednat) {
+    struct dhcp_dnat_t *t = dhcp->freednat;
+    dhcp->freednat = t->next;
+    free(t);
+  }
 
-/**
- * dhcp_timeout()
- * Need to call this function at regular intervals to clean up old connections.
- **/
-int dhcp_timeout(struct dhcp_t *this)
-{
-  /*dhcp_validate(this);*/
+  while (dhcp->freenat) {
+    struct dhcp_nat_t *n = dhcp->freenat;
+    dhcp->freenat = n->nexthash;
+    free(n);
+  }
 
-  dhcp_checkconn(this);
-  
-  return 0;
+  free(dhcp);
 }
 
 /**
  * dhcp_timeleft()
- * Use this function to find out when to call dhcp_timeout()
+ * Use this function to find out when to call timer_wheel_run()
  * If service is needed after the value given by tvp then tvp
  * is left unchanged.
  **/
@@ -2141,6 +2242,124 @@ int dhcp_dns(struct dhcp_conn_t *conn, uint8_t *pack,
   return 1;
 }
 
+#define dhcp_dnat_bucket(ip, port) \
+  ((ntohs(port) ^ (ntohl(ip) * 31)) & (DHCP_DNAT_HASH - 1))
+
+static inline void
+dhcp_dnat_lru_unlink(struct dhcp_dnat_t *t, struct dhcp_nat_t *n) {
+  if (n->lru_prev) n->lru_prev->lru_next = n->lru_next;
+  else t->lru_first = n->lru_next;
+  if (n->lru_next) n->lru_next->lru_prev = n->lru_prev;
+  else t->lru_last = n->lru_prev;
+}
+
+static inline void
+dhcp_dnat_lru_push(struct dhcp_dnat_t *t, struct dhcp_nat_t *n) {
+  n->lru_prev = NULL;
+  n->lru_next = t->lru_first;
+  if (t->lru_first) t->lru_first->lru_prev = n;
+  else t->lru_last = n;
+  t->lru_first = n;
+}
+
+/**
+ * dhcp_dnat_find()
+ * Looks up the DNAT entry of a (redirected) client flow.
+ **/
+struct dhcp_nat_t *dhcp_dnat_find(struct dhcp_conn_t *conn,
+				  uint32_t src_ip, uint16_t src_port) {
+  struct dhcp_nat_t *n;
+
+  if (!conn->dnat)
+    return NULL;
+
+  for (n = conn->dnat->hash[dhcp_dnat_bucket(src_ip, src_port)];
+       n; n = n->nexthash)
+    if (n->src_ip == src_ip && n->src_port == src_port)
+      return n;
+
+  return NULL;
+}
+
+static void dhcp_dnat_unhash(struct dhcp_dnat_t *t, struct dhcp_nat_t *n) {
+  struct dhcp_nat_t **p = &t->hash[dhcp_dnat_bucket(n->src_ip, n->src_port)];
+  for (; *p; p = &(*p)->nexthash) {
+    if (*p == n) {
+      *p = n->nexthash;
+      break;
+    }
+  }
+}
+
+/*
+ * Returns a new entry for the flow, recycling the least recently used
+ * flow of the connection once it has DHCP_DNAT_MAX of them.
+ */
+static struct dhcp_nat_t *
+dhcp_dnat_new(struct dhcp_conn_t *conn, uint32_t src_ip, uint16_t src_port) {
+  struct dhcp_t *this = conn->parent;
+  struct dhcp_dnat_t *t = conn->dnat;
+  struct dhcp_nat_t *n;
+  int h;
+
+  if (!t) {
+    if ((t = this->freednat)) {
+      this->freednat = t->next;
+      memset(t, 0, sizeof(*t));
+    } else if (!(t = calloc(1, sizeof(*t)))) {
+      log_err(errno, "Out of memory!");
+      return NULL;
+    }
+    conn->dnat = t;
+  }
+
+  if (t->count >= DHCP_DNAT_MAX) {
+    n = t->lru_last;
+    dhcp_dnat_lru_unlink(t, n);
+    dhcp_dnat_unhash(t, n);
+  } else {
+    if ((n = this->freenat)) {
+      this->freenat = n->nexthash;
+    } else if (!(n = malloc(sizeof(*n)))) {
+      log_err(errno, "Out of memory!");
+      return NULL;
+    }
+    t->count++;
+  }
+
+  memset(n, 0, sizeof(*n));
+  n->src_ip = src_ip;
+  n->src_port = src_port;
+
+  h = dhcp_dnat_bucket(src_ip, src_port);
+  n->nexthash = t->hash[h];
+  t->hash[h] = n;
+  dhcp_dnat_lru_push(t, n);
+
+  return n;
+}
+
+/*
+ * Gives the DNAT table of the connection, and all its entries, back
+ * to the pool.
+ */
+static void dhcp_dnat_release(struct dhcp_t *this, struct dhcp_conn_t *conn) {
+  struct dhcp_dnat_t *t = conn->dnat;
+  struct dhcp_nat_t *n, *next;
+
+  if (!t) return;
+
+  for (n = t->lru_first; n; n = next) {
+    next = n->lru_next;
+    n->nexthash = this->freenat;
+    this->freenat = n;
+  }
+
+  t->next = this->freednat;
+  this->freednat = t;
+  conn->dnat = NULL;
+}
+
 static 
 int dhcp_uam_nat(struct dhcp_conn_t *conn,
 		 struct pkt_ethhdr_t *ethh,
@@ -2148,38 +2367,31 @@ int dhcp_uam_nat(struct dhcp_conn_t *conn,
 		 struct pkt_tcphdr_t *tcph,
 		 struct in_addr *addr, 
 		 uint16_t port) {
-  int n;
-  int pos = -1;
+  struct dhcp_nat_t *n;
 
 #if(_debug > 1)
   log_dbg("uam_nat %s:%d", inet_ntoa(*addr), port);
 #endif
   
-  for (n=0; n < DHCP_DNAT_MAX; n++) {
-    if (conn->dnat[n].src_ip == iph->saddr && 
-	conn->dnat[n].src_port == tcph->src) {
-      pos = n;
-#if(_debug > 1)
-      log_dbg("uam_nat pos %d", pos);
-#endif
-      break;
+  n = dhcp_dnat_find(conn, iph->saddr, tcph->src);
+
+  if (n) {
+    if (n != conn->dnat->lru_first) {
+      dhcp_dnat_lru_unlink(conn->dnat, n);
+      dhcp_dnat_lru_push(conn->dnat, n);
     }
-  }
-  
-  if (pos == -1) {
-    pos = conn->nextdnat;
+  } else {
+    if (!(n = dhcp_dnat_new(conn, iph->saddr, tcph->src)))
+      return -1;
 #ifdef ENABLE_TAP
     if (_options.usetap) {
-      memcpy(conn->dnat[pos].mac, ethh->dst, PKT_ETH_ALEN); 
+      memcpy(n->mac, ethh->dst, PKT_ETH_ALEN); 
     }
 #endif
-    conn->dnat[pos].src_ip = iph->saddr; 
-    conn->dnat[pos].src_port = tcph->src;
-    conn->nextdnat = (conn->nextdnat + 1) % DHCP_DNAT_MAX;
   }
 
-  conn->dnat[pos].dst_ip = iph->daddr; 
-  conn->dnat[pos].dst_port = tcph->dst;
+  n->dst_ip = iph->daddr; 
+  n->dst_port = tcph->dst;
   
 #ifdef ENABLE_TAP
   if (_options.usetap) {
@@ -2201,26 +2413,21 @@ int dhcp_uam_unnat(struct dhcp_conn_t *conn,
 		   struct pkt_ethhdr_t *ethh,
 		   struct pkt_iphdr_t  *iph,
 		   struct pkt_tcphdr_t *tcph) {
-  int n;
-  for (n=0; n < DHCP_DNAT_MAX; n++) {
-    
-    if (iph->daddr == conn->dnat[n].src_ip && 
-	tcph->dst == conn->dnat[n].src_port) {
-      
+  struct dhcp_nat_t *n = dhcp_dnat_find(conn, iph->daddr, tcph->dst);
+
+  if (n) {
 #ifdef ENABLE_TAP
-      if (_options.usetap) {
-	memcpy(ethh->src, conn->dnat[n].mac, PKT_ETH_ALEN);
-      }
-#endif
-      
-      iph->saddr = conn->dnat[n].dst_ip;
-      tcph->src = conn->dnat[n].dst_port;
-      
-      chksum(iph);
-      
-      return 0; 
+    if (_options.usetap) {
+      memcpy(ethh->src, n->mac, PKT_ETH_ALEN);
     }
+#endif
+    
+    iph->saddr = n->dst_ip;
+    tcph->src = n->dst_port;
+    
+    chksum(iph);
   }
+
   return 0; 
 }
 
@@ -2342,13 +2549,9 @@ int dhcp_garden_check_auth(struct dhcp_t *this,
   } else {
 #endif
 
-    switch (garden_check(_options.authed_pass_throughs, 
-			 &_options.num_authed_pass_throughs, &pt,
-			 ipph, dst
-#ifdef HAVE_PATRICIA
-			 , 0
-#endif
-			 )) {
+    switch (garden_classify(_options.authed_pass_throughs, 
+			    &_options.num_authed_pass_throughs, &pt,
+			    ipph, dst)) {
     case 1:
       found = 1;
       break;
@@ -2398,13 +2601,9 @@ int dhcp_garden_check(struct dhcp_t *this,
   } else {
 #endif
 
-    switch (garden_check(_options.pass_throughs, 
-			 &_options.num_pass_throughs, &pt,
-			 ipph, dst
-#ifdef HAVE_PATRICIA
-			 , 0
-#endif
-			 )) {
+    switch (garden_classify(_options.pass_throughs, 
+			    &_options.num_pass_throughs, &pt,
+			    ipph, dst)) {
     case 1:
       found = 1;
       break;
@@ -2422,13 +2621,9 @@ int dhcp_garden_check(struct dhcp_t *this,
     }
     
     if (!found)
-      switch (garden_check(this->pass_throughs, 
-			   &this->num_pass_throughs, &pt,
-			   ipph, dst
-#ifdef HAVE_PATRICIA
-			   , 0
-#endif
-			   )) {
+      switch (garden_classify(this->pass_throughs, 
+			      &this->num_pass_throughs, &pt,
+			      ipph, dst)) {
       case 1:
 	found = 1;
 	break;
@@ -103,20 +103,47 @@ struct dhcp_t; /* Forward declaration */
 
 #define DHCP_DNAT_MAX       128
 
+#define DHCP_DNAT_HASH       32 /* Buckets per connection, power of 2 */
+
 struct dhcp_nat_t {
   uint8_t mac[PKT_ETH_ALEN];
   uint32_t dst_ip;
   uint16_t dst_port;
   uint32_t src_ip;
   uint16_t src_port;
+  struct dhcp_nat_t *nexthash;  /* Bucket chain, or free list */
+  struct dhcp_nat_t *lru_prev;  /* More recently used */
+  struct dhcp_nat_t *lru_next;  /* Less recently used */
+};
+
+/*
+ * Per connection DNAT flow table, only allocated (from a pool kept
+ * in struct dhcp_t) once the connection is first redirected.
+ */
+struct dhcp_dnat_t {
+  struct dhcp_nat_t *hash[DHCP_DNAT_HASH];
+  struct dhcp_nat_t *lru_first;
+  struct dhcp_nat_t *lru_last;
+  struct dhcp_dnat_t *next;     /* Free list */
+  int count;
+};
+
+/*
+ * One slot of the open-addressing MAC hash table. The full 64 bit
+ * hash doubles as a fingerprint, so a probe only dereferences conn
+ * when the fingerprint matches. An empty slot has conn == NULL.
+ */
+struct dhcp_hash_slot {
+  uint64_t hash;
+  struct dhcp_conn_t *conn;
 };
 
 struct dhcp_conn_t {
-  struct dhcp_conn_t *nexthash; /* Linked list part of hash table */
   struct dhcp_conn_t *next;     /* Next in linked list. 0: Last */
   struct dhcp_conn_t *prev;     /* Previous in linked list. 0: First */
   struct dhcp_t *parent;        /* Parent of all connections */
   void *peer;                   /* Peer protocol handler */
+  struct timer_node leasetimer; /* Lease expiry */
 
 #ifdef ENABLE_CLUSTER
   uint8_t peerid;
@@ -138,9 +165,8 @@ struct dhcp_conn_t {
   int authstate;               /* 0: Unauthenticated, 1: Authenticated */
   uint8_t unauth_cp;           /* Unauthenticated codepoint */
   uint8_t auth_cp;             /* Authenticated codepoint */
-  int nextdnat;                /* Next location to use for DNAT */
   uint32_t dnatdns;            /* Destination NAT for dns mapping */
-  struct dhcp_nat_t dnat[DHCP_DNAT_MAX]; /* Destination NAT */
+  struct dhcp_dnat_t *dnat;    /* Destination NAT, NULL until used */
   uint16_t mtu;                /* Maximum transfer unit */
 
   struct in_addr migrateip;    /* Client IP address to migrate to */
@@ -234,7 +260,12 @@ struct dhcp_t {
   int hashsize;                 /* Size of hash table */
   int hashlog;                  /* Log2 size of hash table */
   int hashmask;                 /* Bitmask for calculating hash */
-  struct dhcp_conn_t **hash;    /* Hashsize array of pointer to member */
+  int hashcount;                /* Number of occupied slots */
+  struct dhcp_hash_slot *hash;  /* Hashsize array of slots */
+
+  /* Pools for the per connection DNAT tables */
+  struct dhcp_dnat_t *freednat;
+  struct dhcp_nat_t *freenat;
 
 #ifdef HAVE_PATRICIA
   patricia_tree_t *ptree;
@@ -267,7 +298,7 @@ int dhcp_set(struct dhcp_t *dhcp, char *ethers, int debug);
 
 void dhcp_free(struct dhcp_t *dhcp);
 
-int dhcp_timeout(struct dhcp_t *this);
+void dhcp_lease_timer(struct dhcp_conn_t *conn);
 
 int dhcp_send(struct dhcp_t *this, int idx,
 	      unsigned char *hismac, uint8_t *packet, size_t length);
@@ -316,6 +347,9 @@ int dhcp_newconn(struct dhcp_t *this, struct dhcp_conn_t **conn, uint8_t *hwaddr
 
 int dhcp_freeconn(struct dhcp_conn_t *conn, int term_cause);
 
+struct dhcp_nat_t *dhcp_dnat_find(struct dhcp_conn_t *conn,
+				  uint32_t src_ip, uint16_t src_port);
+
 int dhcp_arp_ind(struct dhcp_t *this);  /* ARP Indication */
 
 int dhcp_sendEAP(struct dhcp_conn_t *conn, uint8_t *pack, size_t len);
@@ -106,13 +106,16 @@ dns_fullname(char *data, size_t dlen,      /* buffer to store name */
 }
 
 static void 
-add_A_to_garden(uint8_t *p) {
+add_A_to_garden(uint8_t *p, uint32_t ttl) {
   struct in_addr reqaddr;
   pass_through pt;
   memcpy(&reqaddr.s_addr, p, 4);
   memset(&pt, 0, sizeof(pass_through));
   pt.mask.s_addr = 0xffffffff;
   pt.host = reqaddr;
+#ifdef ENABLE_GARDENEXT
+  pt.expiry = mainclock_now() + ttl + GARDEN_DNS_GRACE;
+#endif
   if (pass_through_add(dhcp->pass_throughs,
 		       MAX_PASS_THROUGHS,
 		       &dhcp->num_pass_throughs,
@@ -197,43 +200,12 @@ dns_copy_res(struct dhcp_conn_t *conn, int q,
     *left = len;
 
     if (!isReq && *qmatch == -1 && 
-	_options.uamdomains && _options.uamdomains[0]) {
-      int id;
-
-      for (id=0; _options.uamdomains[id] && id < MAX_UAM_DOMAINS; id++) {
-	
-	size_t qst_len = strlen((char *)question);
-	size_t dom_len = strlen(_options.uamdomains[id]);
-	
+	_options.uamdomains[0] && 
+	garden_check_domain((char *) question)) {
 #if(_debug_)
-	log_dbg("checking %s [%s]",
-		_options.uamdomains[id], question);
+      log_dbg("matched uamdomain [%s]", question);
 #endif
-	
-	if ( qst_len && dom_len && 
-	     (
-	      /*
-	       *  Match if question equals the uamdomain
-	       */
-	      ( qst_len == dom_len &&
-		!strcmp(_options.uamdomains[id], (char *)question) ) ||
-	      /*
-	       *  Match if the question is longer than uamdomain,
-	       *  and ends with the '.' followed by uamdomain
-	       */
-	      ( qst_len > dom_len && 
-		(_options.uamdomains[id][0] == '.' ||
-		 question[qst_len - dom_len - 1] == '.') &&
-		!strcmp(_options.uamdomains[id], 
-			(char *)question + qst_len - dom_len) )
-	      ) ) {
-#if(_debug_)
-	  log_dbg("matched %s [%s]", _options.uamdomains[id], question);
-#endif
-	  *qmatch = 1;
-	  break;
-	}
-      }
+      *qmatch = 1;
     }
 
 #ifdef ENABLE_UAMDOMAINFILE
@@ -285,8 +257,8 @@ dns_copy_res(struct dhcp_conn_t *conn, int q,
     log_dbg("Rewriting DNS ttl from %d to %d", 
 	    (int) ttl, _options.uamdomain_ttl);
 #endif
-    ul = _options.uamdomain_ttl;
-    ul = htonl(ul);
+    ttl = _options.uamdomain_ttl;
+    ul = htonl(ttl);
     memcpy(pkt_ttl, &ul, sizeof(ul));
     *modified = 1;
   }
@@ -327,7 +299,7 @@ dns_copy_res(struct dhcp_conn_t *conn, int q,
     if (*qmatch == 1) {
       size_t offset;
       for (offset=0; offset < rdlen; offset += 4) {
-	add_A_to_garden(p_pkt+offset);
+	add_A_to_garden(p_pkt+offset, ttl);
       }
     }
     break;
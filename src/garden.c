@@ -364,15 +364,652 @@ int garden_check(pass_through *ptlist, uint32_t *pcnt,
   return 0;
 }
 
+/*
+ * Compiled form of a pass_through list. Rules are grouped by netmask
+ * and hashed on (host, mask), so a lookup costs one hash probe per
+ * distinct netmask in the list instead of a walk over every entry.
+ * A classifier is rebuilt lazily after its list changes.
+ */
+#define GARDEN_CLASSIFIERS 4
+
+struct garden_rule {
+  uint32_t key;                     /* Host, as in pass_through */
+  uint32_t mask;
+  int next;                         /* Next rule in bucket, -1: last */
+  pass_through *pt;
+};
+
+struct garden_classifier {
+  pass_through *ptlist;             /* List compiled, NULL: unused */
+  uint32_t ptcnt;
+  uint8_t dirty;
+  int nmasks;
+  int maxmasks;
+  uint32_t *masks;                  /* Distinct netmasks in the list */
+  uint32_t hashmask;
+  int *bucket;
+  struct garden_rule *rules;
+};
+
+static struct garden_classifier classifiers[GARDEN_CLASSIFIERS];
+
+static inline uint32_t garden_hash(uint32_t key, uint32_t mask) {
+  uint32_t h = (key ^ (mask * 0x9e3779b9)) * 0x85ebca6b;
+  return h ^ (h >> 16);
+}
+
+static int garden_compile(struct garden_classifier *gc, uint32_t ptcnt) {
+  uint32_t size;
+  int i, m;
+  void *p;
+
+  for (size = 16; size < ptcnt * 2; size <<= 1);
+
+  if (!(p = realloc(gc->bucket, size * sizeof(int))))
+    return -1;
+  gc->bucket = p;
+
+  if (!(p = realloc(gc->rules, (ptcnt ? ptcnt : 1) * 
+		    sizeof(struct garden_rule))))
+    return -1;
+  gc->rules = p;
+
+  memset(gc->bucket, 0xff, size * sizeof(int));
+  gc->hashmask = size - 1;
+  gc->nmasks = 0;
+
+  /* Insert back to front, so each bucket chain keeps list order */
+  for (i = ptcnt - 1; i >= 0; i--) {
+    pass_through *pt = &gc->ptlist[i];
+    struct garden_rule *r = &gc->rules[i];
+    uint32_t h;
+
+    r->pt = pt;
+    r->key = pt->host.s_addr;
+    r->mask = pt->host.s_addr ? pt->mask.s_addr : 0;
+
+    for (m = 0; m < gc->nmasks; m++)
+      if (gc->masks[m] == r->mask) break;
+    if (m == gc->nmasks) {
+      /* masks need not be CIDR, so there may be any number of them */
+      if (gc->nmasks == gc->maxmasks) {
+	int n = gc->maxmasks ? gc->maxmasks * 2 : 8;
+	if (!(p = realloc(gc->masks, n * sizeof(uint32_t))))
+	  return -1;
+	gc->masks = p;
+	gc->maxmasks = n;
+      }
+      gc->masks[gc->nmasks++] = r->mask;
+    }
+
+    h = garden_hash(r->key, r->mask) & gc->hashmask;
+    r->next = gc->bucket[h];
+    gc->bucket[h] = i;
+  }
+
+  gc->ptcnt = ptcnt;
+  gc->dirty = 0;
+  return 0;
+}
+
+/*
+ * The uamdomains as a trie of reversed labels (com -> example -> www),
+ * so a DNS question is matched in one walk over its own labels instead
+ * of comparing it with every configured domain. The children of all
+ * nodes share one hash on (parent, label).
+ */
+#define GARDEN_DOMAIN_EXACT  1          /* example.com: it and below */
+#define GARDEN_DOMAIN_BELOW  2          /* .example.com: below only */
+
+struct garden_domain_node {
+  char *label;
+  int len;
+  int parent;
+  int next;                         /* Hash chain */
+  int flags;
+};
+
+static struct {
+  struct garden_domain_node *node;
+  int nodes;
+  int *hash;
+  uint32_t hashmask;
+  char *names;                      /* Label storage */
+  char dirty;
+} garden_domains = { .dirty = 1 };
+
+static inline uint32_t garden_domain_hash(int parent, const char *label, int len) {
+  uint32_t h = 2166136261u ^ (uint32_t)parent;
+  while (len-- > 0)
+    h = (h ^ (uint8_t)*label++) * 16777619u;
+  return h & garden_domains.hashmask;
+}
+
+static int garden_domain_find(int parent, const char *label, int len) {
+  int n = garden_domains.hash[garden_domain_hash(parent, label, len)];
+  for (; n >= 0; n = garden_domains.node[n].next) {
+    struct garden_domain_node *gn = &garden_domains.node[n];
+    if (gn->parent == parent && gn->len == len && 
+	!memcmp(gn->label, label, len))
+      return n;
+  }
+  return -1;
+}
+
+static int garden_domain_compile() {
+  size_t size = 0;
+  int labels = 0;
+  uint32_t hsize;
+  char *p;
+  int id;
+
+  free(garden_domains.node);
+  free(garden_domains.hash);
+  free(garden_domains.names);
+  memset(&garden_domains, 0, sizeof(garden_domains));
+
+  for (id = 0; id < MAX_UAM_DOMAINS && _options.uamdomains[id]; id++) {
+    size += strlen(_options.uamdomains[id]) + 1;
+    for (p = _options.uamdomains[id]; *p; p++)
+      if (*p == '.') labels++;
+    labels++;
+  }
+
+  if (!labels) return 0;
+
+  for (hsize = 16; hsize < labels * 2; hsize <<= 1);
+
+  garden_domains.node = calloc(labels, sizeof(struct garden_domain_node));
+  garden_domains.hash = malloc(hsize * sizeof(int));
+  garden_domains.names = malloc(size);
+
+  if (!garden_domains.node || !garden_domains.hash || !garden_domains.names) {
+    log_err(errno, "Out of memory!");
+    garden_domains.dirty = 1;
+    return -1;
+  }
+
+  memset(garden_domains.hash, 0xff, hsize * sizeof(int));
+  garden_domains.hashmask = hsize - 1;
+
+  for (id = 0, p = garden_domains.names; 
+       id < MAX_UAM_DOMAINS && _options.uamdomains[id]; id++) {
+    char *name = p;
+    char *end;
+    int flags = GARDEN_DOMAIN_EXACT;
+    int parent = -1;
+
+    strcpy(name, _options.uamdomains[id]);
+    p += strlen(name) + 1;
+
+    if (name[0] == '.') {
+      flags = GARDEN_DOMAIN_BELOW;
+      name++;
+    }
+
+    if (!*_options.uamdomains[id]) continue;
+
+    end = name + strlen(name);
+    for (;;) {
+      char *label = end;
+      int n;
+
+      while (label > name && label[-1] != '.') label--;
+
+      if ((n = garden_domain_find(parent, label, end - label)) < 0) {
+	uint32_t h = garden_domain_hash(parent, label, end - label);
+	n = garden_domains.nodes++;
+	garden_domains.node[n].label = label;
+	garden_domains.node[n].len = end - label;
+	garden_domains.node[n].parent = parent;
+	garden_domains.node[n].next = garden_domains.hash[h];
+	garden_domains.hash[h] = n;
+      }
+
+      if (label == name) {
+	garden_domains.node[n].flags |= flags;
+	break;
+      }
+
+      parent = n;
+      end = label - 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * garden_check_domain()
+ * Returns 1 if the DNS question is one of the uamdomains, or below
+ * one, 0 otherwise.
+ **/
+int garden_check_domain(char *question) {
+  char *end = question + strlen(question);
+  int parent = -1;
+
+  if (garden_domains.dirty)
+    garden_domain_compile();
+
+  if (!garden_domains.nodes || end == question)
+    return 0;
+
+  for (;;) {
+    char *label = end;
+    int n;
+
+    while (label > question && label[-1] != '.') label--;
+
+    if ((n = garden_domain_find(parent, label, end - label)) < 0)
+      return 0;
+
+    if (garden_domains.node[n].flags & GARDEN_DOMAIN_EXACT)
+      return 1;
+
+    if (label == question)
+      return 0;
+
+    if (garden_domains.node[n].flags & GARDEN_DOMAIN_BELOW)
+      return 1;
+
+    parent = n;
+    end = label - 1;
+  }
+}
+
+/**
+ * garden_invalidate()
+ * Marks the classifier of a list (or of all lists, if NULL) stale.
+ **/
+void garden_invalidate(pass_through *ptlist) {
+  int i;
+  for (i = 0; i < GARDEN_CLASSIFIERS; i++)
+    if (!ptlist || classifiers[i].ptlist == ptlist)
+      classifiers[i].dirty = 1;
+  if (!ptlist)
+    garden_domains.dirty = 1;
+}
+
+/**
+ * garden_classify()
+ * Same as garden_check(), but through the compiled classifier of the
+ * list. The first matching entry in list order decides, as there:
+ * returns 1 on a match, -1 (with pt_match) if that entry has expired,
+ * 0 otherwise.
+ **/
+int garden_classify(pass_through *ptlist, uint32_t *ptcnt, 
+		    pass_through **pt_match,
+		    struct pkt_ipphdr_t *ipph, int dst) {
+  struct garden_classifier *gc = 0;
+  pass_through *pt;
+  int first = -1;
+  uint32_t addr = dst ? ipph->daddr : ipph->saddr;
+  uint16_t port = dst ? ipph->dport : ipph->sport;
+  int has_port = (ipph->protocol == PKT_IP_PROTO_TCP ||
+		  ipph->protocol == PKT_IP_PROTO_UDP);
+  int i, m;
+
+  for (i = 0; i < GARDEN_CLASSIFIERS; i++) {
+    if (classifiers[i].ptlist == ptlist) {
+      gc = &classifiers[i];
+      break;
+    }
+    if (!gc && !classifiers[i].ptlist)
+      gc = &classifiers[i];
+  }
+
+  if (gc && !gc->ptlist) {
+    gc->ptlist = ptlist;
+    gc->dirty = 1;
+  }
+
+  if (!gc || ((gc->dirty || gc->ptcnt != *ptcnt) && 
+	      garden_compile(gc, *ptcnt))) {
+    if (gc) gc->dirty = 1;
+    return garden_check(ptlist, ptcnt, pt_match, ipph, dst
+#ifdef HAVE_PATRICIA
+			, 0
+#endif
+			);
+  }
+
+  /* Chains keep list order, so the first hit of each mask group is
+   * its earliest entry; the earliest across groups wins */
+  for (m = 0; m < gc->nmasks && first != 0; m++) {
+    uint32_t mask = gc->masks[m];
+    uint32_t key = addr & mask;
+
+    for (i = gc->bucket[garden_hash(key, mask) & gc->hashmask]; 
+	 i >= 0 && (first < 0 || i < first); i = gc->rules[i].next) {
+      struct garden_rule *r = &gc->rules[i];
+
+      pt = r->pt;
+
+      if (r->key != key || r->mask != mask)
+	continue;
+      if (pt->proto && ipph->protocol != pt->proto)
+	continue;
+      if (pt->port && !(has_port && port == htons(pt->port)))
+	continue;
+
+      first = i;
+      break;
+    }
+  }
+
+  if (first < 0)
+    return 0;
+
+  pt = gc->rules[first].pt;
+  if (pt_match) *pt_match = pt;
+
+#ifdef ENABLE_GARDENEXT
+  if (pt->expiry && pt->expiry < mainclock_now())
+    return -1;
+#endif
+
+  return 1;
+}
+
+/*
+ * Index over a dynamic pass_through list (the DNS learned garden).
+ * The list stays a dense array, in no particular order, so it can be
+ * printed and classified as before. A hash on the entry finds
+ * duplicates, and a heap ordered by expiry (entries without one last,
+ * oldest first) picks what to expire or evict. Removal moves the last
+ * entry into the hole, so add and remove cost O(log n).
+ */
+#define GARDEN_DYN_LISTS 2
+
+struct garden_dyn {
+  pass_through *ptlist;             /* NULL: unused */
+  uint32_t ptlen;
+  uint32_t *ptcnt;
+  uint32_t hashmask;
+  int *hash;                        /* Bucket heads */
+  int *hnext;                       /* Bucket chain, per entry */
+  uint32_t *heap;                   /* Entry indexes */
+  uint32_t *heappos;                /* Heap position, per entry */
+  uint32_t *seq;                    /* Insertion order, per entry */
+  uint32_t nextseq;
+};
+
+static struct garden_dyn garden_dyns[GARDEN_DYN_LISTS];
+
+static struct garden_dyn *garden_dyn_find(pass_through *ptlist) {
+  int i;
+  for (i = 0; i < GARDEN_DYN_LISTS; i++)
+    if (garden_dyns[i].ptlist == ptlist)
+      return &garden_dyns[i];
+  return 0;
+}
+
+static inline uint32_t garden_dyn_hash(struct garden_dyn *d, pass_through *pt) {
+  uint32_t h = pt->host.s_addr * 0x9e3779b9;
+  h ^= pt->mask.s_addr * 0x85ebca6b;
+  h ^= ((uint32_t)pt->proto << 16 | pt->port) * 0xc2b2ae35;
+  return (h ^ (h >> 15)) & d->hashmask;
+}
+
+static int garden_dyn_lookup(struct garden_dyn *d, pass_through *pt) {
+  int i;
+  for (i = d->hash[garden_dyn_hash(d, pt)]; i >= 0; i = d->hnext[i])
+    if (pt_equal(&d->ptlist[i], pt))
+      return i;
+  return -1;
+}
+
+static void garden_dyn_link(struct garden_dyn *d, int i) {
+  uint32_t h = garden_dyn_hash(d, &d->ptlist[i]);
+  d->hnext[i] = d->hash[h];
+  d->hash[h] = i;
+}
+
+static void garden_dyn_unlink(struct garden_dyn *d, int i) {
+  int *p = &d->hash[garden_dyn_hash(d, &d->ptlist[i])];
+  for (; *p >= 0; p = &d->hnext[*p]) {
+    if (*p == i) {
+      *p = d->hnext[i];
+      break;
+    }
+  }
+}
+
+/* Heap order: soonest expiry first, then oldest */
+static inline int garden_dyn_before(struct garden_dyn *d, uint32_t a, uint32_t b) {
+#ifdef ENABLE_GARDENEXT
+  time_t ea = d->ptlist[a].expiry, eb = d->ptlist[b].expiry;
+  if (ea != eb) {
+    if (!ea) return 0;
+    if (!eb) return 1;
+    return ea < eb;
+  }
+#endif
+  return (int32_t)(d->seq[a] - d->seq[b]) < 0;
+}
+
+static inline void garden_dyn_heapset(struct garden_dyn *d, uint32_t pos, uint32_t i) {
+  d->heap[pos] = i;
+  d->heappos[i] = pos;
+}
+
+static void garden_dyn_heapfix(struct garden_dyn *d, uint32_t pos) {
+  uint32_t n = *d->ptcnt;
+  uint32_t i = d->heap[pos];
+
+  while (pos > 0 && garden_dyn_before(d, i, d->heap[(pos - 1) / 2])) {
+    garden_dyn_heapset(d, pos, d->heap[(pos - 1) / 2]);
+    pos = (pos - 1) / 2;
+  }
+
+  for (;;) {
+    uint32_t c = 2 * pos + 1;
+    if (c >= n) break;
+    if (c + 1 < n && garden_dyn_before(d, d->heap[c + 1], d->heap[c])) c++;
+    if (!garden_dyn_before(d, d->heap[c], i)) break;
+    garden_dyn_heapset(d, pos, d->heap[c]);
+    pos = c;
+  }
+
+  garden_dyn_heapset(d, pos, i);
+}
+
+static void garden_dyn_remove(struct garden_dyn *d, int i
+#ifdef HAVE_PATRICIA
+			      , patricia_tree_t *ptree
+#endif
+			      ) {
+  uint32_t last = *d->ptcnt - 1;
+  uint32_t pos = d->heappos[i];
+#ifdef HAVE_PATRICIA
+  pass_through pt = d->ptlist[i];
+#endif
+
+  garden_dyn_unlink(d, i);
+
+  /* Take it out of the heap */
+  *d->ptcnt = last;
+  if (pos != last) {
+    garden_dyn_heapset(d, pos, d->heap[last]);
+    garden_dyn_heapfix(d, pos);
+  }
+
+  /* Fill the hole with the last entry */
+  if (i != last) {
+    garden_dyn_unlink(d, last);
+    memcpy(&d->ptlist[i], &d->ptlist[last], sizeof(pass_through));
+    d->seq[i] = d->seq[last];
+    garden_dyn_heapset(d, d->heappos[last], i);
+    garden_dyn_link(d, i);
+  }
+
+#ifdef HAVE_PATRICIA
+  if (ptree)
+    garden_patricia_rem(&pt, ptree);
+#endif
+
+  garden_invalidate(d->ptlist);
+}
+
+/**
+ * garden_dyn_init()
+ * Indexes a dynamic pass_through list for pass_through_add/rem().
+ **/
+int garden_dyn_init(pass_through *ptlist, uint32_t ptlen, uint32_t *ptcnt) {
+  struct garden_dyn *d = garden_dyn_find(0);
+  uint32_t size;
+  uint32_t i;
+
+  if (!d) return -1;
+
+  for (size = 16; size < ptlen * 2; size <<= 1);
+
+  d->hash = malloc(size * sizeof(int));
+  d->hnext = calloc(ptlen, sizeof(int));
+  d->heap = calloc(ptlen, sizeof(uint32_t));
+  d->heappos = calloc(ptlen, sizeof(uint32_t));
+  d->seq = calloc(ptlen, sizeof(uint32_t));
+
+  if (!d->hash || !d->hnext || !d->heap || !d->heappos || !d->seq) {
+    log_err(errno, "Out of memory!");
+    d->ptlist = ptlist;
+    garden_dyn_free(ptlist);
+    return -1;
+  }
+
+  memset(d->hash, 0xff, size * sizeof(int));
+  d->hashmask = size - 1;
+  d->ptlist = ptlist;
+  d->ptlen = ptlen;
+  d->ptcnt = ptcnt;
+  d->nextseq = 0;
+
+  for (i = 0; i < *ptcnt; i++) {
+    d->seq[i] = d->nextseq++;
+    garden_dyn_link(d, i);
+    garden_dyn_heapset(d, i, i);
+    garden_dyn_heapfix(d, i);
+  }
+
+  return 0;
+}
+
+void garden_dyn_free(pass_through *ptlist) {
+  struct garden_dyn *d = garden_dyn_find(ptlist);
+  if (!d) return;
+  free(d->hash);
+  free(d->hnext);
+  free(d->heap);
+  free(d->heappos);
+  free(d->seq);
+  memset(d, 0, sizeof(*d));
+}
+
+static int garden_dyn_rem(struct garden_dyn *d, pass_through *pt
+#ifdef HAVE_PATRICIA
+			  , patricia_tree_t *ptree
+#endif
+			  ) {
+  int i = garden_dyn_lookup(d, pt);
+
+  if (i >= 0) {
+    log_dbg("Uamallowed removing #%d: proto=%d host=%s port=%d", 
+	    i, pt->proto, inet_ntoa(pt->host), pt->port);
+    garden_dyn_remove(d, i
+#ifdef HAVE_PATRICIA
+		      , ptree
+#endif
+		      );
+  }
+
+  return 0;
+}
+
+static int garden_dyn_add(struct garden_dyn *d, pass_through *pt, char is_dyn
+#ifdef HAVE_PATRICIA
+			  , patricia_tree_t *ptree
+#endif
+			  ) {
+  uint32_t cnt;
+  int i;
+
+#ifdef ENABLE_GARDENEXT
+  /* Drop what has expired */
+  while (*d->ptcnt > 0) {
+    pass_through *top = &d->ptlist[d->heap[0]];
+    if (!top->expiry || top->expiry >= mainclock_now())
+      break;
+    garden_dyn_remove(d, d->heap[0]
+#ifdef HAVE_PATRICIA
+		      , ptree
+#endif
+		      );
+  }
+#endif
+
+  if ((i = garden_dyn_lookup(d, pt)) >= 0) {
+    log_dbg("Uamallowed already exists #%d:%d: proto=%d host=%s port=%d", 
+	    i, d->ptlen, pt->proto, inet_ntoa(pt->host), pt->port);
+    if (!is_dyn)
+      return 0;
+    /* Refresh expiry and age */
+    memcpy(&d->ptlist[i], pt, sizeof(pass_through));
+    d->seq[i] = d->nextseq++;
+    garden_dyn_heapfix(d, d->heappos[i]);
+    return 0;
+  }
+
+  if (*d->ptcnt == d->ptlen) {
+    if (!is_dyn) {
+      log_dbg("No more room for walled garden entries");
+      return -1;
+    }
+    log_dbg("Evicting uamallowed #%d", d->heap[0]);
+    garden_dyn_remove(d, d->heap[0]
+#ifdef HAVE_PATRICIA
+		      , ptree
+#endif
+		      );
+  }
+
+  cnt = *d->ptcnt;
+
+  log_dbg("Uamallowed IP address #%d:%d: proto=%d host=%s port=%d", 
+	  cnt, d->ptlen, pt->proto, inet_ntoa(pt->host), pt->port);
+
+  memcpy(&d->ptlist[cnt], pt, sizeof(pass_through));
+  d->seq[cnt] = d->nextseq++;
+  garden_dyn_link(d, cnt);
+  *d->ptcnt = cnt + 1;
+  garden_dyn_heapset(d, cnt, cnt);
+  garden_dyn_heapfix(d, cnt);
+
+#ifdef HAVE_PATRICIA
+  if (ptree)
+    garden_patricia_add(pt, ptree);
+#endif
+
+  garden_invalidate(d->ptlist);
+  return 0;
+}
+
 int pass_through_rem(pass_through *ptlist, uint32_t *ptcnt, 
 		     pass_through *pt
 #ifdef HAVE_PATRICIA
 		     , patricia_tree_t *ptree
 #endif
 		     ) {
+  struct garden_dyn *d = garden_dyn_find(ptlist);
   uint32_t cnt = *ptcnt;
   int i;
 
+  if (d) 
+    return garden_dyn_rem(d, pt
+#ifdef HAVE_PATRICIA
+			  , ptree
+#endif
+			  );
+
   for (i=0; i < cnt; i++) {
     if (pt_equal(&ptlist[i], pt)) {
       log_dbg("Uamallowed removing #%d: proto=%d host=%s port=%d", 
@@ -390,6 +1027,7 @@ int pass_through_rem(pass_through *ptlist, uint32_t *ptcnt,
     garden_patricia_rem(pt, ptree);
 #endif
 
+  garden_invalidate(ptlist);
   return 0;
 }
 
@@ -400,9 +1038,17 @@ int pass_through_add(pass_through *ptlist, uint32_t ptlen,
 		     , patricia_tree_t *ptree
 #endif
 		     ) {
+  struct garden_dyn *d = garden_dyn_find(ptlist);
   uint32_t cnt = *ptcnt;
   int i;
 
+  if (d) 
+    return garden_dyn_add(d, pt, is_dyn
+#ifdef HAVE_PATRICIA
+			  , ptree
+#endif
+			  );
+
   for (i=0; i < cnt; i++) {
     if (pt_equal(&ptlist[i], pt)) {
       log_dbg("Uamallowed already exists #%d:%d: proto=%d host=%s port=%d", 
@@ -443,6 +1089,7 @@ int pass_through_add(pass_through *ptlist, uint32_t ptlen,
     garden_patricia_add(pt, ptree);
 #endif
 
+  garden_invalidate(ptlist);
   return 0;
 }
 
@@ -624,20 +1271,107 @@ int regex_pass_throughs_from_string(regex_pass_through *ptlist, uint32_t ptlen,
 typedef struct uamdomain_regex_t {
   regex_t re;
   char neg;
+  char *pattern;
   struct uamdomain_regex_t *next;
 } uamdomain_regex;
 
 static uamdomain_regex * _list_head = 0;
 
+/*
+ * The regexes of the file are also compiled in batches, as one
+ * alternation each. A DNS name is run through a batch first, and only
+ * through its members, in file order, when the batch matches.
+ */
+#define UAMDOMAIN_BATCH 64
+
+typedef struct uamdomain_batch_t {
+  regex_t re;
+  char compiled;
+  uamdomain_regex *first;
+  int count;
+  struct uamdomain_batch_t *next;
+} uamdomain_batch;
+
+static uamdomain_batch * _batch_head = 0;
+
 void garden_free_domainfile() {
+  while (_batch_head) {
+    uamdomain_batch * b = _batch_head;
+    _batch_head = _batch_head->next;
+    if (b->compiled)
+      regfree(&b->re);
+    free(b);
+  }
   while (_list_head) {
     uamdomain_regex * n = _list_head;
     _list_head = _list_head->next;
     regfree(&n->re);
+    free(n->pattern);
     free(n);
   }
 }
 
+static int uamdomain_backref(char *pattern) {
+  if (!pattern) return 1;
+  for (; *pattern; pattern++) {
+    if (*pattern != '\\') continue;
+    if (isdigit((int) pattern[1])) return 1;
+    if (pattern[1]) pattern++;
+  }
+  return 0;
+}
+
+static void garden_batch_domainfile() {
+  uamdomain_batch * b_end = 0;
+  uamdomain_regex * uam_re = _list_head;
+
+  while (uam_re) {
+    uamdomain_batch * b = (uamdomain_batch *)
+      calloc(sizeof(uamdomain_batch), 1);
+    bstring re = bfromcstr("");
+    int alone;
+
+    if (!b || !re) {
+      log_err(errno, "Out of memory!");
+      free(b);
+      if (re) bdestroy(re);
+      return;
+    }
+
+    b->first = uam_re;
+
+    /* Back-references would be renumbered in an alternation */
+    alone = uamdomain_backref(uam_re->pattern);
+
+    do {
+      if (b->count) bcatcstr(re, "|");
+      bcatcstr(re, "(");
+      bcatcstr(re, uam_re->pattern);
+      bcatcstr(re, ")");
+      b->count++;
+      uam_re = uam_re->next;
+    } while (!alone && uam_re && b->count < UAMDOMAIN_BATCH &&
+	     !uamdomain_backref(uam_re->pattern));
+
+    if (b->count > 1) {
+      if (regcomp(&b->re, (char *) re->data, REG_EXTENDED | REG_NOSUB))
+	log_warn(0, "could not compile %d domain regexes together", 
+		 b->count);
+      else
+	b->compiled = 1;
+    }
+
+    bdestroy(re);
+
+    if (b_end) {
+      b_end->next = b;
+      b_end = b;
+    } else {
+      _batch_head = b_end = b;
+    }
+  }
+}
+
 void garden_load_domainfile() {
   garden_free_domainfile();
   if (!_options.uamdomainfile) return;
@@ -681,6 +1415,8 @@ void garden_load_domainfile() {
 	  free(uam_re);
 	  continue;
 	}
+
+	uam_re->pattern = strdup(pline);
 	
 	if (uam_end) {
 	  uam_end->next = uam_re;
@@ -695,23 +1431,31 @@ void garden_load_domainfile() {
     
     if (line)
       free(line);
+
+    garden_batch_domainfile();
   }
 }
 
 int garden_check_domainfile(char *question) {
-  uamdomain_regex * uam_re = _list_head;
-  
-  while (uam_re) {
-    int match = !regexec(&uam_re->re, question, 0, 0, 0);
+  uamdomain_batch * b = _batch_head;
+
+  for (; b; b = b->next) {
+    uamdomain_regex * uam_re = b->first;
+    int i;
+
+    if (b->compiled && regexec(&b->re, question, 0, 0, 0))
+      continue;
+
+    for (i = 0; i < b->count; i++, uam_re = uam_re->next) {
+      int match = !regexec(&uam_re->re, question, 0, 0, 0);
     
 #if(_debug_)
-    if (match)
-      log_dbg("matched DNS name %s", question);
+      if (match)
+	log_dbg("matched DNS name %s", question);
 #endif
 
-    if (match) return uam_re->neg ? 0 : 1;
-    
-    uam_re = uam_re->next;
+      if (match) return uam_re->neg ? 0 : 1;
+    }
   }
 
   return -1;
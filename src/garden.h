@@ -90,6 +90,17 @@ int garden_check(pass_through *ptlist, uint32_t *ptcnt,
 #endif
 		 );
 
+int garden_classify(pass_through *ptlist, uint32_t *ptcnt, 
+		    pass_through **pt_match,
+		    struct pkt_ipphdr_t *ipph, int dst);
+
+void garden_invalidate(pass_through *ptlist);
+
+int garden_dyn_init(pass_through *ptlist, uint32_t ptlen, uint32_t *ptcnt);
+void garden_dyn_free(pass_through *ptlist);
+
+int garden_check_domain(char *question);
+
 #ifdef ENABLE_CHILLIQUERY
 void garden_print(int fd);
 #endif
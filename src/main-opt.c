@@ -375,9 +375,12 @@ int main(int argc, char **argv) {
     log_err(0,"radproxy not implemented. build with --enable-radproxy");
 #endif
   _options.txqlen = args_info.txqlen_arg;
+  _options.tunnapi = args_info.tunnapi_flag;
+  _options.tunqueues = args_info.tunqueues_arg;
 #ifdef USING_MMAP
   _options.ringsize = args_info.ringsize_arg;
   _options.mmapring = args_info.mmapring_flag;
+  _options.mmapv3 = args_info.mmapv3_flag;
 #endif
   _options.sndbuf = args_info.sndbuf_arg;
   _options.rcvbuf = args_info.rcvbuf_arg;
@@ -395,12 +398,16 @@ int main(int argc, char **argv) {
   _options.tcpmss = args_info.tcpmss_arg;
   _options.max_clients = args_info.maxclients_arg;
   _options.radiusqsize = args_info.radiusqsize_arg;
+  _options.redirkeepalive = args_info.redirkeepalive_arg;
+  _options.redirmaxconn = args_info.redirmaxconn_arg;
   _options.dhcphashsize = args_info.dhcphashsize_arg;
   _options.uamdomain_ttl = args_info.uamdomainttl_arg;
   _options.seskeepalive = args_info.seskeepalive_flag;
   _options.uamallowpost = args_info.uamallowpost_flag;
   _options.redir = args_info.redir_flag;
   _options.redirurl = args_info.redirurl_flag;
+  _options.redirfork = args_info.redirfork_flag;
+  _options.redirprobe = args_info.redirprobe_flag;
   _options.statusfilesave = args_info.statusfilesave_flag;
   _options.dhcpnotidle = args_info.dhcpnotidle_flag;
 #if(_debug_ && !defined(ENABLE_CHILLIREDIR))
@@ -1127,6 +1134,8 @@ int main(int argc, char **argv) {
   _options.sslkeypass = STRDUP(args_info.sslkeypass_arg);
   _options.sslcertfile = STRDUP(args_info.sslcertfile_arg);
   _options.sslcafile = STRDUP(args_info.sslcafile_arg);
+  _options.sslecdsacertfile = STRDUP(args_info.sslecdsacertfile_arg);
+  _options.sslecdsakeyfile = STRDUP(args_info.sslecdsakeyfile_arg);
 #endif
 
 #ifdef USING_IPC_UNIX
@@ -30,7 +30,7 @@ static select_ctx sctx;
 #endif
 
 static int max_requests = 0;
-static redir_request * requests = 0;
+static redir_request ** requests = 0;
 static redir_request * requests_free = 0;
 
 #ifdef ENABLE_REDIRINJECT
@@ -70,25 +70,54 @@ static bstring string_init_reset(bstring s) {
   return s;
 }
 
-static redir_request * get_request() {
-  redir_request * req = 0;
+/*
+ *  Grow the request pool by REDIR_REQUEST_CHUNK, up to redirmaxconn.
+ *  Requests are allocated in chunks that never move, as pointers to
+ *  them are held by the connection handlers and the free list.
+ */
+static int grow_requests() {
+  int limit = _options.redirmaxconn > 0 ? _options.redirmaxconn : 1;
+  int n = max_requests + REDIR_REQUEST_CHUNK;
+  redir_request **r;
+  redir_request *chunk;
   int i;
-  
-  if (!max_requests) {
 
-    max_requests = 2048; /* hard maximum! (should be configurable) */
-    
-    requests = (redir_request *) calloc(max_requests, sizeof(redir_request));
-    for (i=0; i < max_requests; i++) {
-      requests[i].index = i;
-      if (i > 0) 
-	requests[i].prev = &requests[i-1];
-      if ((i+1) < max_requests) 
-	requests[i].next = &requests[i+1];
+  if (n > limit) n = limit;
+  if (n <= max_requests) return -1;
+
+  if (!(r = (redir_request **) realloc(requests, n * sizeof(*r)))) {
+    log_err(errno, "realloc() failed");
+    return -1;
+  }
+  requests = r;
+
+  if (!(chunk = (redir_request *) calloc(n - max_requests, 
+					 sizeof(redir_request)))) {
+    log_err(errno, "calloc() failed");
+    return -1;
+  }
+
+  for (i = n - 1; i >= max_requests; i--) {
+    redir_request *req = &chunk[i - max_requests];
+    req->index = i;
+    requests[i] = req;
+    if (requests_free) {
+      requests_free->prev = req;
+      req->next = requests_free;
     }
-    
-    requests_free = requests;
+    requests_free = req;
   }
+
+  log_dbg("redir request pool grown to %d", n);
+  max_requests = n;
+  return 0;
+}
+
+static redir_request * get_request() {
+  redir_request * req = 0;
+  
+  if (!requests_free)
+    grow_requests();
   
   if (requests_free) {
     if (_options.debug) {
@@ -117,6 +146,7 @@ static redir_request * get_request() {
   /*req->post = string_init_reset(req->post);*/
   req->dbuf = string_init_reset(req->dbuf);
   req->wbuf = string_init_reset(req->wbuf);
+  req->hscan = req->hlen = 0;
   req->hbuf = string_init_reset(req->hbuf);
   req->ibuf = string_init_reset(req->ibuf);
 
@@ -132,10 +162,15 @@ static redir_request * get_request() {
   
   req->read_closed = 0;
   req->write_closed = 0;
+  req->keepalive = 0;
   req->state = 0;
   req->next = req->prev = 0;
   req->html = req->proxy = req->headers = 0;
   req->chunked = req->gzip = 0;
+  req->upstream_close = req->head = 0;
+  req->chunk_state = req->chunk_left = 0;
+  req->inject_state = 0;
+  req->conn.paused = 0;
   req->clen = -1;
   req->inuse = 1;
   return req;
@@ -161,55 +196,17 @@ sock_redir_getstate(struct redir_t *redir,
 		    struct sockaddr_in *baddress,
 		    struct redir_conn_t *conn) {
   struct redir_msg_t msg;
-  struct sockaddr_un remote;
-  size_t len = sizeof(remote);
-  int s;
-
-  char filedest[512];
-
-  statedir_file(filedest, sizeof(filedest), _options.unixipc, "chilli.ipc");
 
   memset(&msg, 0, sizeof(msg));
   msg.mtype = REDIR_MSG_STATUS_TYPE;
   memcpy(&msg.mdata.address, address, sizeof(msg.mdata.address));
   memcpy(&msg.mdata.baddress, baddress, sizeof(msg.mdata.baddress));
 
-  if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-    log_err(errno, "socket()");
-    return -1;
-  }
-
-  memset(&remote, 0, sizeof(remote));
-
-  remote.sun_family = AF_UNIX;
-  strcpy(remote.sun_path, filedest);
-
-#if defined (__FreeBSD__)  || defined (__APPLE__) || defined (__OpenBSD__)
-  remote.sun_len = strlen(remote.sun_path) + 1;
-#endif
-
-  len = offsetof(struct sockaddr_un, sun_path) + strlen(remote.sun_path);
-
-  if (safe_connect(s, (struct sockaddr *)&remote, len) == -1) {
-    log_err(errno, "could not connect to %s", remote.sun_path);
-    close(s);
-    return -1;
-  }
-  
-  if (safe_write(s, &msg, sizeof(msg)) != sizeof(msg)) {
-    log_err(errno, "could not write to %s", remote.sun_path);
-    close(s);
+  if (redir_ipc_status(&msg, conn)) {
+    log_warn(0, "no session available from chilli.ipc");
     return -1;
   }
 
-  if (safe_read(s, conn, sizeof(*conn)) != sizeof(*conn)) {
-    log_warn(0, "no session available from %s", remote.sun_path);
-    close(s);
-    return -1;
-  }
-
-  close(s);
-
   return conn->s_state.authenticated == 1;
 }
 
@@ -315,13 +312,224 @@ static int redir_cli_write(redir_request *req, uint8_t *d, int l) {
   return w;
 }
 
+#define REDIR_CHUNK_SIZE    0
+#define REDIR_CHUNK_EXT     1
+#define REDIR_CHUNK_DATA    2
+#define REDIR_CHUNK_DATAEND 3
+#define REDIR_CHUNK_TRAILER 4
+#define REDIR_CHUNK_LINE    5
+#define REDIR_CHUNK_DONE    6
+
+/*
+ *  Follow the framing of a chunked upstream body, to tell where the
+ *  response ends. Returns 1 once the last chunk and trailer are seen.
+ *  The chunk data is appended to out, when given.
+ */
+static int redir_chunk_scan(redir_request *req, uint8_t *d, int l, 
+			    bstring out) {
+  while (l > 0 && req->chunk_state != REDIR_CHUNK_DONE) {
+    uint8_t c = *d;
+
+    switch (req->chunk_state) {
+    case REDIR_CHUNK_DATA:
+      {
+	int n = l < req->chunk_left ? l : req->chunk_left;
+	req->chunk_left -= n;
+	if (out)
+	  bcatblk(out, d, n);
+	if (!req->chunk_left)
+	  req->chunk_state = REDIR_CHUNK_DATAEND;
+	d += n;
+	l -= n;
+      }
+      continue;
+
+    case REDIR_CHUNK_SIZE:
+      if (isxdigit(c)) {
+	if (req->chunk_left > 0x7ffffff) {
+	  req->upstream_close = 1;
+	  return -1;
+	}
+	req->chunk_left = (req->chunk_left << 4) | 
+	  (isdigit(c) ? c - '0' : (tolower(c) - 'a' + 10));
+	break;
+      }
+      if (c != '\n') {
+	if (c != '\r') req->chunk_state = REDIR_CHUNK_EXT;
+	break;
+      }
+      /* fall through */
+    case REDIR_CHUNK_EXT:
+      if (c == '\n')
+	req->chunk_state = req->chunk_left ? 
+	  REDIR_CHUNK_DATA : REDIR_CHUNK_TRAILER;
+      break;
+
+    case REDIR_CHUNK_DATAEND:
+      if (c == '\n') {
+	req->chunk_state = REDIR_CHUNK_SIZE;
+	req->chunk_left = 0;
+      }
+      break;
+
+    case REDIR_CHUNK_TRAILER:
+      if (c == '\n') 
+	req->chunk_state = REDIR_CHUNK_DONE;
+      else if (c != '\r') 
+	req->chunk_state = REDIR_CHUNK_LINE;
+      break;
+
+    case REDIR_CHUNK_LINE:
+      if (c == '\n') 
+	req->chunk_state = REDIR_CHUNK_TRAILER;
+      break;
+    }
+
+    d++;
+    l--;
+  }
+
+  return req->chunk_state == REDIR_CHUNK_DONE;
+}
+
+#ifdef ENABLE_REDIRINJECT
+#define REDIR_INJECT_TAG   5        /* "<head" matched */
+#define REDIR_INJECT_ATTR  6        /* inside the <head ...> tag */
+#define REDIR_INJECT_DONE  7
+
+/*
+ *  Find where to inject into a streamed HTML body: just past the
+ *  opening <head> tag. The match carries over between blocks in
+ *  req->inject_state. Returns the offset in d, or -1.
+ */
+static int redir_inject_scan(redir_request *req, uint8_t *d, int l) {
+  static const char tag[] = "<head";
+  int i;
+
+  for (i = 0; i < l; i++) {
+    int c = tolower(d[i]);
+
+    switch (req->inject_state) {
+    case REDIR_INJECT_TAG:
+      if (c == '>')
+	return i + 1;
+      if (isspace(c) || c == '/')
+	req->inject_state = REDIR_INJECT_ATTR;
+      else
+	req->inject_state = (c == '<');
+      break;
+
+    case REDIR_INJECT_ATTR:
+      if (c == '>')
+	return i + 1;
+      break;
+
+    default:
+      if (c == tag[(int)req->inject_state])
+	req->inject_state++;
+      else
+	req->inject_state = (c == '<');
+      break;
+    }
+  }
+
+  return -1;
+}
+
+/*
+ *  Pass a block of an HTML body on to the client, injecting where
+ *  redir_inject_scan() finds the place, or at the end of the body
+ *  when the page has no <head>. A chunked body is decoded and each
+ *  block sent on as a chunk of its own, so only the block at hand
+ *  is ever held.
+ */
+static int redir_inject_stream(redir_request *req, bstring inject,
+			       uint8_t *d, int l) {
+  bstring out = bfromcstralloc(l + inject->slen + 32, "");
+  bstring body = 0;
+  int done, at = -1, w;
+
+  if (req->chunked) {
+    body = bfromcstralloc(l, "");
+    done = redir_chunk_scan(req, d, l, body) == 1;
+    d = body->data;
+    l = body->slen;
+  } else {
+    done = req->clen == 0;
+  }
+
+  if (req->inject_state != REDIR_INJECT_DONE)
+    at = redir_inject_scan(req, d, l);
+
+  if (at >= 0) {
+    bcatblk(out, d, at);
+    bconcat(out, inject);
+    bcatblk(out, d + at, l - at);
+    req->inject_state = REDIR_INJECT_DONE;
+  } else {
+    bcatblk(out, d, l);
+  }
+
+  if (done && req->inject_state != REDIR_INJECT_DONE) {
+    bconcat(out, inject);
+    req->inject_state = REDIR_INJECT_DONE;
+  }
+
+  if (req->chunked) {
+    bstring frame = bfromcstralloc(out->slen + 32, "");
+    char tmp[16];
+    if (out->slen > 0) {
+      safe_snprintf(tmp, sizeof(tmp), "%x\r\n", out->slen);
+      bcatcstr(frame, tmp);
+      bconcat(frame, out);
+      bcatcstr(frame, "\r\n");
+    }
+    if (done)
+      bcatcstr(frame, "0\r\n\r\n");
+    bdestroy(out);
+    bdestroy(body);
+    out = frame;
+  }
+
+  w = out->slen ? redir_cli_write(req, out->data, out->slen) : 0;
+  bdestroy(out);
+  return w;
+}
+#endif
+
+/*
+ *  The upstream response is complete: park the server connection
+ *  for the next request to it, or close it when the server would,
+ *  and close the client once the reply has drained.
+ */
+static int redir_conn_release(redir_request *req) {
+  if (req->state & REDIR_CONN_FD) {
+    net_select_rmfd(&sctx, req->conn.sock);
+    req->state &= ~REDIR_CONN_FD;
+  }
+
+  if (req->upstream_close || 
+      conn_pool_put(&req->conn, &req->uaddr, req->uport))
+    conn_close(&req->conn);
+
+  req->read_closed = 1;
+
+  if (!conn_write_remaining(&req->conn)) {
+    redir_conn_finish(&req->conn, req);
+    return -1;
+  }
+
+  return 0;
+}
+
 static int redir_conn_read(struct conn_t *conn, void *ctx) {
   redir_request *req = (redir_request *)ctx;
   uint8_t bb[PKT_MAX_LEN];
-  int s, r;
+  int r;
 
-  if ((s=redir_cli_rewrite(req, conn)) != 0) 
-    return 0;
+  /* flush what is queued first; reading is paused while it is large */
+  if (redir_cli_rewrite(req, conn) == -1)
+    return -1;
   
   r = safe_recv(conn->sock, bb, sizeof(bb)-1, 0);
   
@@ -337,8 +545,17 @@ static int redir_conn_read(struct conn_t *conn, void *ctx) {
       return -1;
     }
 
+#ifdef ENABLE_REDIRINJECT
+    /* a body that ends with the connection still gets its injection */
+    if (!req->read_closed && req->html && !req->chunked &&
+	req->inject_state != REDIR_INJECT_DONE && req->ibuf->slen) {
+      req->inject_state = REDIR_INJECT_DONE;
+      redir_cli_write(req, req->ibuf->data, req->ibuf->slen);
+    }
+#endif
+
     req->read_closed = 1;
-    
+
   } else if (r < 0 && 
 	     errno != EWOULDBLOCK && errno != EAGAIN) {
     
@@ -364,19 +581,33 @@ static int redir_conn_read(struct conn_t *conn, void *ctx) {
       
       bcatblk(req->hbuf, bb, r);
       
-      if ((eoh = strstr((char *)req->hbuf->data, newline))) {
+      if (!(eoh = strstr((char *)req->hbuf->data, newline)) &&
+	  req->hbuf->slen > REDIR_INJECT_HEADER) {
+	/* give up on injecting; the framing is unknown from here */
+	log_dbg("upstream header over %d bytes", REDIR_INJECT_HEADER);
+	req->headers = 1;
+	req->upstream_close = 1;
+	redir_cli_write(req, req->hbuf->data, req->hbuf->slen);
+	bassigncstr(req->hbuf, "");
+      } else if (eoh) {
 	
 	int header_len = eoh - (char *)req->hbuf->data;
+	int body_len;
 	bstring newhdr = bfromcstr("");
+	int status = 0;
 
-	if (strncmp((char *)req->hbuf->data, "HTTP/1.", 7) ||
-	    strncmp((char *)req->hbuf->data+8, " 2", 2)) {
-	  
+	if (!strncmp((char *)req->hbuf->data, "HTTP/1.", 7))
+	  status = atoi((char *)req->hbuf->data + 9);
+
+	/* only a HTTP/1.1 final response can leave the server connection open */
+	if (status < 200 || strncmp((char *)req->hbuf->data, "HTTP/1.1", 8))
+	  req->upstream_close = 1;
+
+	if (status < 200 || status > 299) {
 	  log_dbg("Not HTTP/1.X 2XX reply");
-	  bcatblk(newhdr, req->hbuf->data, header_len + 4);
-	  
-	} else {
-	  
+	}
+
+	{
 	  char *hdr, *p;
 	  int clen = 0;
 	  
@@ -402,20 +633,44 @@ static int redir_conn_read(struct conn_t *conn, void *ctx) {
 	      log_dbg("Detected Content Length %d", req->clen);
 	      hdr[l] = c;
 	    } else if (!strncasecmp(hdr, "content-type:", 13)) {
-	      if (strstr(hdr, "text/html")) {
+	      if (status >= 200 && status <= 299 && strstr(hdr, "text/html")) {
 		req->html = 1;
 	      }
-	    } else if (strcasestr(hdr, "content-encoding: gzip")) {
-	      req->gzip = 1;
-	    } else if (strcasestr(hdr, "transfer-encoding:") && 
-		       strstr(hdr,"chunked")) {
-	      req->chunked = 1;
+	    } else if (!strncasecmp(hdr, "connection:", 11)) {
+	      char c = hdr[l];
+	      hdr[l] = 0;
+	      if (strcasestr(hdr + 11, "close"))
+		req->upstream_close = 1;
+	      hdr[l] = c;
+	    } else if (!strncasecmp(hdr, "content-encoding:", 17)) {
+	      char c = hdr[l];
+	      hdr[l] = 0;
+	      if (strcasestr(hdr + 17, "gzip"))
+		req->gzip = 1;
+	      hdr[l] = c;
+	    } else if (!strncasecmp(hdr, "transfer-encoding:", 18)) {
+	      char c = hdr[l];
+	      hdr[l] = 0;
+	      if (strcasestr(hdr + 18, "chunked"))
+		req->chunked = 1;
+	      hdr[l] = c;
 	    }
 	    
 	    hdr += l + 2;
 	    if (!p) break;
 	  }
 
+	  /* no body follows, whatever the headers say */
+	  if (req->head || status == 204 || status == 304) {
+	    req->clen = 0;
+	    req->chunked = 0;
+	    req->html = 0;
+	  }
+
+	  /* compressed and empty bodies are passed on as they are */
+	  if (req->gzip || req->clen == 0)
+	    req->html = 0;
+
 	  hdr = (char *)req->hbuf->data;
 	  
 	  while (hdr && *hdr) {
@@ -432,15 +687,16 @@ static int redir_conn_read(struct conn_t *conn, void *ctx) {
 	      l = (eoh - hdr);
 	    }
 	    
-	    if (req->html) {
+	    if (!strncasecmp(hdr, "connection:", 11) ||
+		!strncasecmp(hdr, "keep-alive:", 11)) {
+	      skip = 1;
+	    } else if (req->html) {
 	      if (clen && !strncasecmp(hdr, "content-length:", 15)) {
 		char tmp[128];
 		if (inject) clen += inject->slen;
 		safe_snprintf(tmp, sizeof(tmp), "Content-Length: %d\r\n", clen);
 		bcatcstr(newhdr, tmp);
 		skip = 1;
-	      } else if (!strncasecmp(hdr, "connection:", 11)) {
-		skip = 1;
 	      } else if (!strncasecmp(hdr, "accept-ranges:", 14)) {
 		skip = 1;
 	      }
@@ -465,38 +721,45 @@ static int redir_conn_read(struct conn_t *conn, void *ctx) {
 	  /* Adjust content-length */
 	  
 	  bcatblk(newhdr, newline, 2);
-	  
-	  if (req->html) {
-	    if (req->chunked) {
-	      char tmp[56];
-	      safe_snprintf(tmp, sizeof(tmp), "%x\r\n", 
-			    inject->slen);
-	      bcatcstr(newhdr, tmp);
-	    }
-	    bconcat(newhdr, inject);
-	    if (req->chunked) {
-	      bcatblk(newhdr, newline, 2);
-	    }
-	  }
 	}
 
-	bcatblk(newhdr, eoh + 4, req->hbuf->slen - header_len - 4);
+	body_len = req->hbuf->slen - header_len - 4;
 	if (req->clen > 0) /* adjust clen */
-	  req->clen -= (req->hbuf->slen - header_len - 4);
-	redir_cli_write(req, newhdr->data, newhdr->slen);
+	  req->clen -= body_len;
 	req->headers = 1;
+
+	if (req->html) {
+	  redir_cli_write(req, newhdr->data, newhdr->slen);
+	  redir_inject_stream(req, inject, (uint8_t *)eoh + 4, body_len);
+	} else {
+	  bcatblk(newhdr, eoh + 4, body_len);
+	  if (req->chunked)
+	    redir_chunk_scan(req, (uint8_t *)eoh + 4, body_len, 0);
+	  redir_cli_write(req, newhdr->data, newhdr->slen);
+	}
 	bdestroy(newhdr);
       }
+    } else if (inject && req->html) {
+      if (req->clen > 0)
+	req->clen -= r;
+      redir_inject_stream(req, inject, bb, r);
     } else {
 #endif
 
       redir_cli_write(req, bb, r);
       if (req->clen > 0)
 	req->clen -= r;
+      if (req->headers && req->chunked)
+	redir_chunk_scan(req, bb, r, 0);
 
 #ifdef ENABLE_REDIRINJECT
     }
 #endif
+
+    if (req->headers && 
+	(req->chunked ? req->chunk_state == REDIR_CHUNK_DONE : 
+	 req->clen == 0))
+      return redir_conn_release(req);
   }
   /*log_dbg("leaving redir_conn_read()");*/
   return 0;
@@ -535,6 +798,40 @@ check_regex(regex_t *re, char *regex, char *s) {
   return 1;
 }
 
+/*
+ *  Connect a proxied request to its server once the hostname has
+ *  resolved, reusing a pooled connection when there is one.
+ *  Returns 0 when connecting or still waiting on DNS.
+ */
+static int redir_upstream(redir_request *req) {
+  switch (conn_dns_resolve(req->uhost, &req->uaddr)) {
+  case 0:
+    req->state |= REDIR_CONN_DNS;
+    return 0;
+  case -1:
+    log_dbg("could not resolve %s", req->uhost);
+    return -1;
+  }
+
+  req->state &= ~REDIR_CONN_DNS;
+
+  if (!conn_pool_get(&req->conn, &req->uaddr, req->uport) &&
+      conn_sock(&req->conn, &req->uaddr, req->uport)) {
+    log_err(errno, "conn_sock()");
+    return -1;
+  }
+    
+  req->state |= REDIR_CONN_FD;
+  net_select_addfd(&sctx, req->conn.sock, SELECT_READ);
+  return 0;
+}
+
+static void redir_dns_init() {
+  int fd = conn_dns_fd();
+  if (conn_dns_init(&_options.dns1, &_options.dns2) > 0 && !fd)
+    net_select_addfd(&sctx, conn_dns_fd(), SELECT_READ);
+}
+
 static int 
 redir_handle_url(struct redir_t *redir, 
 		 struct redir_conn_t *conn, 
@@ -629,9 +926,13 @@ redir_handle_url(struct redir_t *redir,
     if (hasInject) {
       bstring newhdr = bfromcstr("");
       char *hdr = (char *)req->wbuf->data;
+      char eoh = 0;
 
       if (_options.inject_wispr)
 	(void) inject_fmt(req, conn);
+
+      /* replies to HEAD are not worth keeping the server connection for */
+      req->head = !strncmp(hdr, "HEAD ", 5);
       
       while (hdr && *hdr) {
 	char *p = strstr(hdr, "\r\n");
@@ -643,12 +944,26 @@ redir_handle_url(struct redir_t *redir,
 	} else {
 	  l = req->wbuf->slen - (hdr - (char*)req->wbuf->data);
 	}
-	
-	if (!strncasecmp(hdr, "accept-encoding:", 16)) {
+
+	if (eoh) {
+	  /* request body */
+	} else if (p == hdr) {
+	  if (req->head && !req->upstream_close) {
+	    bcatcstr(newhdr, "Connection: close\r\n");
+	    req->upstream_close = 1;
+	  }
+	  eoh = 1;
+	} else if (!strncasecmp(hdr, "accept-encoding:", 16)) {
 	  bcatcstr(newhdr, "Accept-Encoding: identity\r\n");
 	  skip = 1;
 	} else if (!strncasecmp(hdr, "connection:", 11)) {
-	  bcatcstr(newhdr, "Connection: close\r\n");
+	  /* the server connection is pooled when the reply allows */
+	  if (req->head) {
+	    bcatcstr(newhdr, "Connection: close\r\n");
+	    req->upstream_close = 1;
+	  } else {
+	    bcatcstr(newhdr, "Connection: keep-alive\r\n");
+	  }
 	  skip = 1;
 	} else if (!strncasecmp(hdr, "keep-alive:", 11)) {
 	  skip = 1;
@@ -681,21 +996,80 @@ redir_handle_url(struct redir_t *redir,
       port = atoi(p);
     }
 
-    if (conn_setup(&req->conn, httpreq->host, port, 
-		   req->wbuf, req->dbuf)) {
-      log_err(errno, "conn_setup()");
-      return -1;
-    }
-    
-    req->state |= REDIR_CONN_FD;
-    net_select_addfd(&sctx, req->conn.sock, SELECT_READ);
+    safe_strncpy(req->uhost, httpreq->host, sizeof(req->uhost));
+    req->uport = port;
 
-    return 0;
+    conn_set_buffers(&req->conn, req->wbuf, req->dbuf);
+
+    return redir_upstream(req);
   }
   
   return 1;
 }
 
+/*
+ *  Drop the request just answered from the front of wbuf, keeping
+ *  whatever the client pipelined behind it, and wait for the next.
+ */
+static void redir_keepalive(redir_request *req) {
+  int hlen = (int) req->hlen;
+
+  if (hlen > req->wbuf->slen) 
+    hlen = req->wbuf->slen;
+
+  bdelete(req->wbuf, 0, hlen);
+  req->hscan = req->hlen = 0;
+  req->last_active = mainclock_tick();
+
+#if(_debug_)
+  log_dbg("keep-alive %d, %d bytes pipelined", 
+	  req->socket_fd, req->wbuf->slen);
+#endif
+}
+
+/*
+ *  Run redir_main() for a client connection until it needs more
+ *  data. Pipelined requests are answered from wbuf one after the
+ *  other. Returns 1 while the connection stays open.
+ */
+static int redir_serve(struct redir_t *redir, redir_request *req) {
+  int fd = req->socket_fd;
+
+  while (1) {
+    switch (redir_main(redir, fd, fd, 
+		       &req->conn.peer,
+		       &req->baddr, 
+		       req->uiidx, 
+		       req)) {
+    case 1:
+#ifdef HAVE_SSL
+      if (req->sslcon && 
+	  openssl_pending(req->sslcon) > 0) {
+	log_dbg("ssl_pending, trying again");
+	continue;
+      }
+#endif
+      return 1;
+
+    case 0:
+      if (req->keepalive && !req->proxy) {
+	redir_keepalive(req);
+	if (req->wbuf->slen) 
+	  continue;
+	return 1;
+      }
+      log_dbg("redir completed %s", inet_ntoa(req->conn.peer.sin_addr));
+      redir_conn_finish(&req->conn, req);
+      return 0;
+
+    default:
+      log_dbg("redir error %s", inet_ntoa(req->conn.peer.sin_addr));
+      redir_conn_finish(&req->conn, req);
+      return -1;
+    }
+  }
+}
+
 int redir_accept2(struct redir_t *redir, int idx) {
   int status;
   int new_socket;
@@ -761,6 +1135,11 @@ int redir_accept2(struct redir_t *redir, int idx) {
   } else {
 
     redir_request *req = get_request();
+
+    if (!req) {
+      close(new_socket);
+      return 0;
+    }
     
     req->parent = redir;
 
@@ -776,8 +1155,7 @@ int redir_accept2(struct redir_t *redir, int idx) {
     conn_set_readhandler(&req->conn, redir_conn_read, req);
     conn_set_donehandler(&req->conn, redir_conn_finish, req);
     
-    switch (redir_main(redir, new_socket, new_socket,
-		       &address, &baddress, idx, req)) {
+    switch (redir_serve(redir, req)) {
     case 1:
       log_dbg("redir queued %s socket_fd=%d conn.fd=%d", 
 	      inet_ntoa(address.sin_addr),
@@ -786,12 +1164,8 @@ int redir_accept2(struct redir_t *redir, int idx) {
       net_select_addfd(&sctx, req->socket_fd, SELECT_READ);
       return 1;
     case 0: 
-      log_dbg("redir completed %s", inet_ntoa(address.sin_addr));
-      redir_conn_finish(&req->conn, req);
       return 0;
     default:
-      log_dbg("redir completed %s", inet_ntoa(address.sin_addr));
-      redir_conn_finish(&req->conn, req);
       return -1;
     }
   }
@@ -855,8 +1229,14 @@ int main(int argc, char **argv) {
 
   redir_set(redir, hwaddr, (_options.debug));
   redir_set_cb_getstate(redir, sock_redir_getstate);
+
+#ifdef HAVE_SSL
+  if (_options.uamuissl || _options.redirssl)
+    initssl();
+#endif
   
   redir->cb_handle_url = redir_handle_url;
+  redir->keepalive = _options.redirkeepalive > 0;
 
   if (net_select_init(&sctx))
     log_err(errno, "select init");
@@ -868,6 +1248,8 @@ int main(int argc, char **argv) {
   net_select_addfd(&sctx, redir->fd[0], SELECT_READ);
   net_select_addfd(&sctx, redir->fd[1], SELECT_READ);
 
+  redir_dns_init();
+
   if (_options.gid && setgid(_options.gid)) {
     log_err(errno, "setgid(%d) failed while running with gid = %d\n", 
 	    _options.gid, getgid());
@@ -885,6 +1267,7 @@ int main(int argc, char **argv) {
     net_select_fd(&sctx, selfpipe, SELECT_READ);
     net_select_fd(&sctx, redir->fd[0], SELECT_READ);
     net_select_fd(&sctx, redir->fd[1], SELECT_READ);
+    net_select_fd(&sctx, conn_dns_fd(), SELECT_READ);
   
     active = 0;
 
@@ -893,25 +1276,49 @@ int main(int argc, char **argv) {
       reload_config = 0;
 
       redir_set(redir, hwaddr, _options.debug);
+#ifdef HAVE_SSL
+      reloadssl();
+#endif
+      redir->keepalive = _options.redirkeepalive > 0;
+      redir_dns_init();
     }
 
+    conn_pool_expire();
+
     for (idx=0; idx < max_requests; idx++) {
+      redir_request *req = requests[idx];
+
+      if (req->inuse && (req->state & REDIR_CONN_DNS) && 
+	  redir_upstream(req) < 0) {
+	redir_conn_finish(&req->conn, req);
+	continue;
+      }
+
+      /* back-pressure: stop reading the server while the client lags */
+      req->conn.paused = (conn_write_remaining(&req->conn) &&
+			  req->dbuf->slen - req->conn.read_pos >= 
+			  REDIR_PROXY_BUFFER);
 
-      conn_select_fd(&requests[idx].conn, &sctx);
+      conn_select_fd(&req->conn, &sctx);
 
-      if (requests[idx].inuse && requests[idx].socket_fd) {
+      if (req->inuse && req->socket_fd) {
 	time_t now = mainclock_tick();
-	int fd = requests[idx].socket_fd;
-	int timeout = 60;
+	int fd = req->socket_fd;
+	int timeout = req->keepalive ? _options.redirkeepalive : 60;
 
-	if (now - requests[idx].last_active > timeout) {
+	if (now - req->last_active > timeout) {
 	  log_dbg("timeout connection %d", idx);
-	  redir_conn_finish(&requests[idx].conn, &requests[idx]);
+	  redir_conn_finish(&req->conn, req);
 	} else {
 	  int evt = SELECT_READ;
 	  timeout = 0;
-	  if (conn_write_remaining(&requests[idx].conn))
+	  if (req->proxy && 
+	      req->wbuf->slen - req->conn.write_pos >= REDIR_PROXY_BUFFER)
+	    evt = 0; /* and the client while the server lags */
+	  if (conn_write_remaining(&req->conn))
 	    evt |= SELECT_WRITE;
+	  if (req->proxy && (req->state & REDIR_SOCKET_FD))
+	    net_select_modfd(&sctx, fd, evt);
 	  net_select_fd(&sctx, fd, evt);
 	  active++;
 	}
@@ -928,13 +1335,13 @@ int main(int argc, char **argv) {
 	    safe_snprintf(line, sizeof(line),
 			  "#%d (%d) %d connection from %s %d",
 			  timeout ? -1 : active, fd, 
-			  (int) requests[idx].last_active,
+			  (int) req->last_active,
 			  inet_ntoa(address.sin_addr),
 			  ntohs(address.sin_port));
 	    
-	    if (requests[idx].conn.sock) {
+	    if (req->conn.sock) {
 	      addrlen = sizeof(address);
-	      if (getpeername(requests[idx].conn.sock,
+	      if (getpeername(req->conn.sock,
 			      (struct sockaddr *)&address,
 			      &addrlen) >= 0) {
 		safe_snprintf(line+strlen(line),
@@ -998,25 +1405,37 @@ int main(int argc, char **argv) {
 	  if (net_select_read_fd(&sctx, redir->fd[1])==1 && 
 	      redir_accept2(redir, 1) < 0)
 	    log_err(0, "redir_accept() failed!");
+
+	if (conn_dns_fd() && 
+	    net_select_read_fd(&sctx, conn_dns_fd())==1 &&
+	    conn_dns_read() > 0) {
+	  for (idx=0; idx < max_requests; idx++) {
+	    redir_request *req = requests[idx];
+	    if (req->inuse && (req->state & REDIR_CONN_DNS) &&
+		redir_upstream(req) < 0)
+	      redir_conn_finish(&req->conn, req);
+	  }
+	}
       
 	for (idx=0; idx < max_requests; idx++) {
+	  redir_request *req = requests[idx];
 
 	  /*
 	   *  Update remote connections with activity
 	   */
-	  conn_select_update(&requests[idx].conn, &sctx);
+	  conn_select_update(&req->conn, &sctx);
 
 	  /*
 	   *  Check client connections with activity
 	   */
-	  if (requests[idx].inuse && requests[idx].socket_fd) {
-	    int fd = requests[idx].socket_fd;
+	  if (req->inuse && req->socket_fd) {
+	    int fd = req->socket_fd;
 	    
 #ifdef HAVE_SSL
-	    if (requests[idx].sslcon) {
-	      if (openssl_check_accept(requests[idx].sslcon, 0) < 0) {
+	    if (req->sslcon) {
+	      if (openssl_check_accept(req->sslcon, 0) < 0) {
 		log_dbg("ssl error %d", errno);
-		redir_conn_finish(&requests[idx].conn, &requests[idx]);
+		redir_conn_finish(&req->conn, req);
 		continue;
 	      }
 	    }
@@ -1025,29 +1444,36 @@ int main(int argc, char **argv) {
 	    switch (net_select_write_fd(&sctx, fd)) {
 	    case 1:
 	      log_dbg("client writeable");
-	      redir_cli_rewrite(&requests[idx], &requests[idx].conn);
+	      if (redir_cli_rewrite(req, &req->conn) == -1)
+		continue;
+	      if (req->read_closed && !req->conn.sock && 
+		  !(req->state & REDIR_CONN_DNS) &&
+		  !conn_write_remaining(&req->conn)) {
+		log_dbg("done writing");
+		redir_conn_finish(&req->conn, req);
+		continue;
+	      }
 	      break;
 	    }
 	    
 	    switch (net_select_read_fd(&sctx, fd)) {
 	    case -1:
 	      log_dbg("EXCEPTION");
-	      redir_conn_finish(&requests[idx].conn, 
-				&requests[idx]);
+	      redir_conn_finish(&req->conn, req);
 	      break;
 
 	    case 1:
 	      {
-		if (requests[idx].proxy) {
+		if (req->proxy) {
 		  char b[PKT_MAX_LEN];
 		  int r;
 		  
 #ifdef HAVE_SSL
-		  if (requests[idx].sslcon) {
+		  if (req->sslcon) {
 		    /*
 		      log_dbg("proxy_read_ssl");
 		    */
-		    r = openssl_read(requests[idx].sslcon, 
+		    r = openssl_read(req->sslcon, 
 				     b, sizeof(b)-1, 0);
 		  } else
 #endif
@@ -1060,63 +1486,34 @@ int main(int argc, char **argv) {
 		  if (r <= 0) {
 
 		    log_dbg("recv %d %d %d", r, 
-			    requests[idx].conn.read_buf->slen -
-			    requests[idx].conn.read_pos,
+			    req->conn.read_buf->slen -
+			    req->conn.read_pos,
 			    errno);
 
 		    if (!(r == -1 && 
 			  (errno == EWOULDBLOCK || errno == EAGAIN))) {
-		      if (redir_cli_rewrite(&requests[idx], 
-					    &requests[idx].conn) == 0) {
+		      if (redir_cli_rewrite(req, &req->conn) == 0) {
 			log_dbg("done reading and writing");
-			redir_conn_finish(&requests[idx].conn, 
-					  &requests[idx]);
+			redir_conn_finish(&req->conn, req);
 		      }
 		    }
 		    
 		  } else if (r > 0) {
 
-		    int w;
-		    requests[idx].last_active = mainclock_tick();
-		    w = net_write(requests[idx].conn.sock, b, r);
-		    
-		    /*
-		      log_dbg("proxy_write: %d", w);
-		    */
-		    if (r != w) {
-		      log_err(errno, "problem writing what we read from client");
-		      redir_conn_finish(&requests[idx].conn, 
-					&requests[idx]);
+		    req->last_active = mainclock_tick();
+
+		    /* queued for the server, written as it becomes writeable */
+		    if (req->conn.write_pos && 
+			req->conn.write_pos == req->wbuf->slen) {
+		      req->conn.write_pos = 0;
+		      bassigncstr(req->wbuf, "");
 		    }
+
+		    bcatblk(req->wbuf, b, r);
 		  }
 		  
 		} else {
-#ifdef HAVE_SSL
-		go_again:
-#endif
-		  switch (redir_main(redir, fd, fd, 
-				     &requests[idx].conn.peer,
-				     &requests[idx].baddr, 
-				     requests[idx].uiidx, 
-				     &requests[idx])) {
-		  case 1:
-		    /*log_dbg("redir cont'ed");*/
-#ifdef HAVE_SSL
-		    if (requests[idx].sslcon && 
-			openssl_pending(requests[idx].sslcon) > 0) {
-		      log_dbg("ssl_pending, trying again");
-		      goto go_again;
-		    }
-#endif
-		  break;
-		  case -1: 
-		    log_dbg("redir error");
-		  default:
-		    log_dbg("redir completed");
-		    redir_conn_finish(&requests[idx].conn, 
-				      &requests[idx]);
-		    break;
-		  }
+		  redir_serve(redir, req);
 		}
 	      }
 	      break;
@@ -699,16 +699,30 @@ net_read_dispatch_eth(net_interface *netif, net_handler func, void *ctx) {
 
 ssize_t 
 net_read_dispatch(net_interface *netif, net_handler func, void *ctx) {
+  return net_read_dispatch_fd(netif->fd, func, ctx);
+}
+
+ssize_t 
+net_read_dispatch_fd(int fd, net_handler func, void *ctx) {
   struct pkt_buffer pb;
   uint8_t packet[PKT_MAX_LEN];
-  ssize_t length;
-  pkt_buffer_init(&pb, packet, sizeof(packet), PKT_BUFFER_IPOFF);
-  length = safe_read(netif->fd, 
-		     pkt_buffer_head(&pb), 
-		     pkt_buffer_size(&pb));
-  if (length <= 0) return length;
-  pb.length = length;
-  return func(ctx, &pb);
+  ssize_t length, ret = 0;
+  int cnt;
+
+  /* Drain up to a batch of packets per wakeup; the fd is non-blocking
+   * so we stop as soon as the device queue is empty */
+  for (cnt = 0; cnt < TUN_READ_BATCH; cnt++) {
+    pkt_buffer_init(&pb, packet, sizeof(packet), PKT_BUFFER_IPOFF);
+    length = safe_read(fd, 
+		       pkt_buffer_head(&pb), 
+		       pkt_buffer_size(&pb));
+    if (length <= 0) 
+      return cnt ? ret : length;
+    pb.length = length;
+    ret = func(ctx, &pb);
+  }
+
+  return ret;
 }
 
 ssize_t 
@@ -1571,21 +1585,95 @@ int net_open_eth(net_interface *netif) {
 
 void net_run(net_interface *iface) {
 #ifdef USING_MMAP
-  if (iface->is_active) {
+  /* Kick the kernel once for all the frames queued in the TX ring
+   * since the last run */
+  if (iface->tx_pending) {
     int ret = send(iface->fd, NULL, 0, MSG_DONTWAIT | MSG_NOSIGNAL);
     
     if (ret == -1 && errno != EAGAIN)
-      log_err(0, "Async write error");
+      log_err(errno, "Async write error");
     else
       ++iface->stats.tx_runs;
     
-    iface->is_active = 0;
+    iface->tx_pending = 0;
   }
 #endif
 }
 
 #ifdef USING_MMAP
 
+#ifdef HAVE_TPACKET3
+/* TX frames share the tp_status/tp_len layout of both header versions */
+#define tx_hdr(iface, f, fld) ((iface)->tp_version == TPACKET_V3 ?	\
+  &((struct tpacket3_hdr *)(f))->fld : &((struct tpacket2_hdr *)(f))->fld)
+
+static int rx_ring_v3(net_interface *iface, net_handler func, void *ctx) {
+  struct tpacket_block_desc *pbd;
+  struct tpacket3_hdr *h;
+  struct pkt_buffer pb;
+  unsigned cnt, i, was_drop;
+
+  was_drop = 0;
+  for (cnt = 0; cnt < iface->rx_ring.cnt; ++cnt) {
+    pbd = iface->rx_ring.frames[iface->rx_ring.idx];
+
+    if (!(pbd->hdr.bh1.block_status & TP_STATUS_USER))
+      break;
+
+    if (++iface->rx_ring.idx >= iface->rx_ring.cnt)
+      iface->rx_ring.idx = 0;
+
+    h = (struct tpacket3_hdr *)((uint8_t *)pbd + 
+				pbd->hdr.bh1.offset_to_first_pkt);
+
+    for (i = 0; i < pbd->hdr.bh1.num_pkts; i++) {
+      if (h->tp_snaplen < (int)sizeof(struct pkt_ethhdr_t)) {
+	log_err(0, "Packet too short");
+	++iface->stats.dropped;
+      } else {
+	if (_options.debug > 100)
+	  log_dbg("RX len=%d spanlen=%d (idx %d)", h->tp_len, h->tp_snaplen, iface->ifindex);
+	
+	pkt_buffer_init(&pb, (uint8_t *)h, h->tp_snaplen, h->tp_mac);
+	pb.length = h->tp_len;
+	
+	iface->stats.rx_bytes += h->tp_len;
+	++iface->stats.rx_cnt;
+
+	func(ctx, &pb);
+      }
+      h = (struct tpacket3_hdr *)((uint8_t *)h + h->tp_next_offset);
+    }
+
+    was_drop |= pbd->hdr.bh1.block_status & TP_STATUS_LOSING;
+
+    /* Hand the whole block back to the kernel */
+    pbd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+  }
+
+  if (cnt >= iface->rx_ring.cnt)
+    ++iface->stats.rx_buffers_full;
+  
+  if (was_drop) {
+    struct tpacket_stats_v3 stats;
+    socklen_t len;
+    
+    len = sizeof(stats);
+    if (!getsockopt(iface->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len))
+      iface->stats.dropped += stats.tp_drops;
+
+    if (_options.logfacility > 100)
+      log_dbg("RX drops %d", iface->stats.dropped);
+  }
+  
+  ++iface->stats.rx_runs;
+
+  return 1;
+}
+#else
+#define tx_hdr(iface, f, fld) (&((struct tpacket2_hdr *)(f))->fld)
+#endif
+
 static int rx_ring(net_interface *iface, net_handler func, void *ctx) {
   unsigned cnt, was_drop;
   struct tpacket2_hdr *h;
@@ -1593,6 +1681,11 @@ static int rx_ring(net_interface *iface, net_handler func, void *ctx) {
   struct pkt_buffer pb;
   void *data;
 
+#ifdef HAVE_TPACKET3
+  if (iface->tp_version == TPACKET_V3)
+    return rx_ring_v3(iface, func, ctx);
+#endif
+
   was_drop = 0;
   for (cnt = 0; cnt < iface->rx_ring.cnt; ++cnt) {
     data = h = iface->rx_ring.frames[iface->rx_ring.idx];
@@ -1620,6 +1713,9 @@ static int rx_ring(net_interface *iface, net_handler func, void *ctx) {
     pkt_buffer_init(&pb, (uint8_t *)data, h->tp_snaplen, h->tp_mac);
     pb.length = h->tp_len;
 
+    iface->stats.rx_bytes += h->tp_len;
+    ++iface->stats.rx_cnt;
+
     func(ctx, &pb);
 
     was_drop |= h->tp_status & TP_STATUS_LOSING;
@@ -1648,9 +1744,24 @@ static int rx_ring(net_interface *iface, net_handler func, void *ctx) {
   return 1;
 }
 
-static int tx_ring(net_interface *iface, void *packet, size_t length) {
-  struct tpacket2_hdr *h;
+static void *tx_frame(net_interface *iface) {
   unsigned cnt;
+  void *h;
+
+  for (cnt = 0; cnt < iface->tx_ring.cnt; ++cnt) {
+    h = iface->tx_ring.frames[iface->tx_ring.idx++];
+    if (iface->tx_ring.idx >= iface->tx_ring.cnt)
+      iface->tx_ring.idx = 0;
+    if (*tx_hdr(iface, h, tp_status) == TP_STATUS_AVAILABLE ||
+	*tx_hdr(iface, h, tp_status) == TP_STATUS_WRONG_FORMAT)
+      return h;
+  }
+
+  return 0;
+}
+
+static int tx_ring(net_interface *iface, void *packet, size_t length) {
+  void *h;
   void *data;
 
   /*int hdrlen = sizeofeth(packet);*/
@@ -1665,54 +1776,64 @@ static int tx_ring(net_interface *iface, void *packet, size_t length) {
   }
 #endif
   
-  for (cnt = 0; cnt < iface->tx_ring.cnt; ++cnt) {
-    h = iface->tx_ring.frames[iface->tx_ring.idx++];
-    if (iface->tx_ring.idx >= iface->tx_ring.cnt)
-      iface->tx_ring.idx = 0;
-    if (h->tp_status == TP_STATUS_AVAILABLE ||
-	h->tp_status == TP_STATUS_WRONG_FORMAT)
-      break;
-  }
-  if (cnt >= iface->tx_ring.cnt) {
+  if (!(h = tx_frame(iface))) {
     ++iface->stats.tx_buffers_full;
-    /*g_ptr_array_add(iface->deferred, q);
-      if (!iface->congested)
-      {
-      modify_fd(iface->fd, &iface->event_ctx, EPOLLIN | EPOLLOUT);
-      iface->congested = TRUE;
-      }
-    */
-    log_warn(0, "dropped packet, buffer full");
-    return -1;
+
+    /* Flush what is queued so far and try once more 
+     * before giving up on the packet */
+    if (iface->tx_pending) {
+      net_run(iface);
+      h = tx_frame(iface);
+    }
+
+    if (!h) {
+      log_warn(0, "dropped packet, buffer full");
+      return -1;
+    }
   }
   
   /* Should not happen */
-  if (h->tp_status == TP_STATUS_WRONG_FORMAT)
+  if (*tx_hdr(iface, h, tp_status) == TP_STATUS_WRONG_FORMAT)
     log_err(0, "Bad packet format on send");
   
   /* Fill the frame */
-  data = (void *)h + iface->tp_hdrlen;
+  data = h + iface->tp_hdrlen;
   memcpy(data, packet, length);
-  h->tp_len = length;
+  *tx_hdr(iface, h, tp_len) = length;
   
-  iface->stats.tx_bytes += h->tp_len;
+  iface->stats.tx_bytes += length;
   ++iface->stats.tx_cnt;
   
-  h->tp_status = TP_STATUS_SEND_REQUEST;
+  *tx_hdr(iface, h, tp_status) = TP_STATUS_SEND_REQUEST;
 
   if (_options.debug > 100)
     log_dbg("TX sent=%d (idx %d)", length, iface->ifindex);
   
-  if (!iface->is_active) {
-    iface->is_active = 1;
-  }
+  /* The kernel is kicked once per main loop pass, see net_run() */
+  ++iface->tx_pending;
 
   return length;
 }
 
+#ifdef HAVE_TPACKET3
+/* Block size and retire timeout (in ms) of a TPACKET_V3 RX ring */
+#ifdef ENABLE_LARGELIMITS
+#define RING_V3_BLOCK_SIZE (256 * 1024)
+#else
+#define RING_V3_BLOCK_SIZE (32 * 1024)
+#endif
+#define RING_V3_BLOCK_TOV 2
+#endif
+
 static void setup_one_ring(net_interface *iface, unsigned ring_size, int mtu, int what) {
   unsigned page_size, max_blocks;
+#ifdef HAVE_TPACKET3
+  struct tpacket_req3 req;
+#else
   struct tpacket_req req;
+#endif
+  socklen_t req_len = sizeof(struct tpacket_req);
+  int by_block = 0;
   struct ring *ring;
   const char *name;
   int ret;
@@ -1757,6 +1878,7 @@ static void setup_one_ring(net_interface *iface, unsigned ring_size, int mtu, in
 				     maxsect * 512 + /*576 + 32*/1000);
   }
   
+  memset(&req, 0, sizeof(req));
   req.tp_frame_size = ring->frame_size;
   
   /* The number of blocks is limited by the kernel implementation */
@@ -1769,16 +1891,34 @@ static void setup_one_ring(net_interface *iface, unsigned ring_size, int mtu, in
   req.tp_block_size = 4 * 1024;
 #endif
 
+#ifdef HAVE_TPACKET3
+  if (iface->tp_version == TPACKET_V3) {
+    req_len = sizeof(req);
+    if (what == PACKET_RX_RING) {
+      /* Packets are packed back to back into blocks which are
+       * handed to us when full or after the retire timeout */
+      req.tp_block_size = RING_V3_BLOCK_SIZE;
+      req.tp_retire_blk_tov = RING_V3_BLOCK_TOV;
+      by_block = 1;
+    }
+  }
+#endif
+
   ret = -1;
   while (req.tp_block_size > req.tp_frame_size && req.tp_block_size >= page_size) {
     req.tp_block_nr = ring_size / req.tp_block_size;
 
+    if (req.tp_block_nr < 2) {
+      req.tp_block_size >>= 1;
+      continue;
+    }
+
     if (req.tp_block_nr > max_blocks)
       req.tp_block_nr = max_blocks;
     
     req.tp_frame_nr = (req.tp_block_size / req.tp_frame_size) * req.tp_block_nr;
     
-    ret = net_setsockopt(iface->fd, SOL_PACKET, what, &req, sizeof(req));
+    ret = net_setsockopt(iface->fd, SOL_PACKET, what, &req, req_len);
     if (!ret)
       break;
 
@@ -1795,20 +1935,37 @@ static void setup_one_ring(net_interface *iface, unsigned ring_size, int mtu, in
   ring->len = req.tp_block_size * req.tp_block_nr;
   ring->block_size = req.tp_block_size;
   ring->cnt = req.tp_frame_nr;
-  ring->frames = calloc(sizeof(void *), req.tp_frame_nr);
+
+  if (by_block) {
+    /* A block based ring is walked one block at a time */
+    ring->frame_size = ring->block_size;
+    ring->cnt = req.tp_block_nr;
+  }
+
+  ring->frames = calloc(sizeof(void *), ring->cnt);
 
   log_info("Created %s ring: len=%d; block size=%d; frame size=%d, cnt=%d", 
 	   name, ring->len, req.tp_block_size, req.tp_frame_size, ring->cnt);
 }
 
 static void destroy_one_ring(net_interface *iface, int what) {
+#ifdef HAVE_TPACKET3
+  struct tpacket_req3 req;
+#else
   struct tpacket_req req;
+#endif
+  socklen_t req_len = sizeof(struct tpacket_req);
   struct ring *ring;
   
   ring = what == PACKET_RX_RING ? &iface->rx_ring : &iface->tx_ring;
+
+#ifdef HAVE_TPACKET3
+  if (iface->tp_version == TPACKET_V3)
+    req_len = sizeof(req);
+#endif
   
   memset(&req, 0, sizeof(req));
-  net_setsockopt(iface->fd, SOL_PACKET, what, &req, sizeof(req));
+  net_setsockopt(iface->fd, SOL_PACKET, what, &req, req_len);
   free(ring->frames);
   memset(ring, 0, sizeof(*ring));
 }
@@ -1845,16 +2002,34 @@ static void setup_rings(net_interface *iface, unsigned size, int mtu) {
   if (!size)
     return;
   
-  /* We want version 2 ring buffers to avoid 64-bit uncleanness */
-  val = TPACKET_V2;
-  ret = net_setsockopt(iface->fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val));
+  /* We want version 2 ring buffers to avoid 64-bit uncleanness,
+   * or version 3 for block based reception when asked for */
+  iface->tp_version = TPACKET_V2;
 
-  if (ret) {
-    log_err(errno, "Failed to set version 2 ring buffer format");
-    return;
+#ifdef HAVE_TPACKET3
+  if (_options.mmapv3) {
+    val = TPACKET_V3;
+    ret = net_setsockopt(iface->fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val));
+    if (ret) 
+      log_err(errno, "Failed to set version 3 ring buffer format, using version 2");
+    else
+      iface->tp_version = TPACKET_V3;
   }
+
+  if (iface->tp_version == TPACKET_V2) {
+#endif
+    val = TPACKET_V2;
+    ret = net_setsockopt(iface->fd, SOL_PACKET, PACKET_VERSION, &val, sizeof(val));
+    
+    if (ret) {
+      log_err(errno, "Failed to set version 2 ring buffer format");
+      return;
+    }
+#ifdef HAVE_TPACKET3
+  }
+#endif
   
-  val = TPACKET_V2;
+  val = iface->tp_version;
   len = sizeof(val);
   ret = getsockopt(iface->fd, SOL_PACKET, PACKET_HDRLEN, &val, &len);
 
@@ -42,6 +42,9 @@
 #define HAVE_PACKET_RX_RING
 #define HAVE_PACKET_TX_RING
 #define HAVE_TPACKET2
+#ifdef TP_STATUS_BLK_TMO
+#define HAVE_TPACKET3
+#endif
 
 #ifndef PACKET_TX_RING
 #define PACKET_TX_RING		13
@@ -121,7 +124,7 @@ struct ring
   unsigned frame_size;
   /* Block size of the ring buffer */
   unsigned block_size;
-  /* Pointers to the individual frames */
+  /* Pointers to the individual frames (or blocks, for a TPACKET_V3 RX ring) */
   void **frames;
 };
 
@@ -225,7 +228,6 @@ typedef struct _net_interface {
 #endif
 
 #ifdef USING_MMAP
-  int is_active;
 
   struct netif_config	cfg;
   struct netif_stats	stats;
@@ -238,6 +240,10 @@ typedef struct _net_interface {
   unsigned ring_len;
   /* The length of the frame header in the rings */
   int tp_hdrlen;
+  /* The TPACKET_Vx format of the rings */
+  int tp_version;
+  /* Number of TX frames queued since the last flush */
+  unsigned tx_pending;
 #endif
 
 #if defined(__linux__)
@@ -298,6 +304,7 @@ ssize_t net_write_eth(net_interface *netif, void *d, size_t dlen,
 #endif
 
 ssize_t net_read_dispatch(net_interface *netif, net_handler func, void *ctx);
+ssize_t net_read_dispatch_fd(int fd, net_handler func, void *ctx);
 ssize_t net_read_dispatch_eth(net_interface *netif, net_handler func, void *ctx);
 
 int net_open_nfqueue(net_interface *netif, uint16_t q, int (*cb)());
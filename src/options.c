@@ -320,6 +320,8 @@ int options_fromfd(int fd, bstring bt) {
   if (!option_s_l(bt, &o.sslkeypass)) return 0;
   if (!option_s_l(bt, &o.sslcertfile)) return 0;
   if (!option_s_l(bt, &o.sslcafile)) return 0;
+  if (!option_s_l(bt, &o.sslecdsacertfile)) return 0;
+  if (!option_s_l(bt, &o.sslecdsakeyfile)) return 0;
 #endif
 #ifdef USING_IPC_UNIX
   if (!option_s_l(bt, &o.unixipc)) return 0;
@@ -405,6 +407,7 @@ int options_fromfd(int fd, bstring bt) {
 
   if (_options._data) free(_options._data);
   memcpy(&_options, &o, sizeof(o));
+  garden_invalidate(0);
   _options._data = (char *)bt->data;
 
 #ifdef ENABLE_MODULES
@@ -515,6 +518,8 @@ int options_save(char *file, bstring bt) {
   if (!option_s_s(bt, &o.sslkeypass)) return 0;
   if (!option_s_s(bt, &o.sslcertfile)) return 0;
   if (!option_s_s(bt, &o.sslcafile)) return 0;
+  if (!option_s_s(bt, &o.sslecdsacertfile)) return 0;
+  if (!option_s_s(bt, &o.sslecdsakeyfile)) return 0;
 #endif
 #ifdef USING_IPC_UNIX
   if (!option_s_s(bt, &o.unixipc)) return 0;
@@ -168,6 +168,8 @@ struct options_t {
   int max_clients;               /* Max subscriber/clients */
   int dhcphashsize;              /* DHCP MAC Hash table size */
   int radiusqsize;               /* Size of RADIUS queue, 0 for default */
+  int redirkeepalive;            /* Idle seconds of persistent chilli_redir connections */
+  int redirmaxconn;              /* Max chilli_redir client connections */
 
   struct in_addr uamlogout;      /* IP address of HTTP auto-logout */
   struct in_addr uamalias;       /* IP address of UAM Alias */
@@ -214,6 +216,8 @@ struct options_t {
   uint8_t uamallowpost:1;           /* Set to true if the UAMPORT is allowed to access a POST */
   uint8_t redir:1;                  /* Launch redir sub-process instead of forking */
   uint8_t redirurl:1;               /* Send redirection URL in UAM query string instead of HTTP redirect */
+  uint8_t redirfork:1;              /* Fork for every redir connection instead of serving it in-process */
+  uint8_t redirprobe:1;             /* Answer captive portal detection probes from a cached redirect */
   uint8_t redirssl:1;               /* Enable redirection of SSL/HTTPS port (requires SSL support) */
   uint8_t uamuissl:1;               /* Enable SSL/HTTPS on uamuiport (requires SSL support) */
   uint8_t domaindnslocal:1;         /* Wildcard option to consider all hostnames *.domain local */
@@ -228,7 +232,10 @@ struct options_t {
 
 #ifdef USING_MMAP
   uint8_t mmapring:1;
+  uint8_t mmapv3:1;                 /* Use TPACKET_V3 block based RX ring */
 #endif
+  uint8_t tunnapi:1;                /* Open the tun/tap device with IFF_NAPI */
+  int tunqueues;                    /* Number of IFF_MULTI_QUEUE tun/tap queues */
 
 #ifdef ENABLE_IPV6
   uint8_t ipv6:1;
@@ -334,6 +341,8 @@ struct options_t {
   char *sslkeypass;
   char *sslcertfile;
   char *sslcafile;
+  char *sslecdsacertfile;
+  char *sslecdsakeyfile;
 #endif
 
   /* local content */
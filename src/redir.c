@@ -186,12 +186,14 @@ static int redir_xmlencode(char *src, int srclen, char *dst, int dstsize) {
 }
 */
 
-static void redir_http(bstring s, char *code) {
-  bassigncstr(s, "HTTP/1.0 ");
+static void redir_http(bstring s, char *code, char keepalive) {
+  bassigncstr(s, keepalive ? "HTTP/1.1 " : "HTTP/1.0 ");
   bcatcstr(s, code);
   bcatcstr(s, "\r\n");
+  bcatcstr(s, keepalive ? 
+	   "Connection: keep-alive\r\n" :
+	   "Connection: close\r\n");
   bcatcstr(s, 
-	   "Connection: close\r\n"
 	   "Pragma: no-cache\r\n"
 	   "Expires: Fri, 01 Jan 1971 00:00:00 GMT\r\n"
 	   "Cache-Control: no-cache, must-revalidate\r\n");
@@ -208,34 +210,54 @@ static int bstrtocstr(bstring src, char *dst, unsigned int len) {
   return 0;
 }
 
-/* Encode src as urlencoded and place null terminated result in dst */
-int redir_urlencode(bstring src, bstring dst) {
-  char x[3];
+/* Append len bytes of src to dst, urlencoded */
+static int redir_urlencode_cat(bstring dst, const char *src, int len) {
+  static const char hex[] = "0123456789abcdef";
+  unsigned char *out;
   int n;
-  
-  bassigncstr(dst, "");
-  for (n=0; n < src->slen; n++) {
-    if ((('A' <= src->data[n]) && (src->data[n] <= 'Z')) ||
-	(('a' <= src->data[n]) && (src->data[n] <= 'z')) ||
-	(('0' <= src->data[n]) && (src->data[n] <= '9')) ||
-	('-' == src->data[n]) ||
-	('_' == src->data[n]) ||
-	('.' == src->data[n]) ||
-	('!' == src->data[n]) ||
-	('~' == src->data[n]) ||
-	('*' == src->data[n])) {
-      bconchar(dst,src->data[n]);
+
+  if (balloc(dst, dst->slen + 3 * len + 1) != BSTR_OK)
+    return -1;
+
+  out = dst->data + dst->slen;
+  for (n=0; n < len; n++) {
+    unsigned char c = (unsigned char)src[n];
+    if ((('A' <= c) && (c <= 'Z')) ||
+	(('a' <= c) && (c <= 'z')) ||
+	(('0' <= c) && (c <= '9')) ||
+	('-' == c) ||
+	('_' == c) ||
+	('.' == c) ||
+	('!' == c) ||
+	('~' == c) ||
+	('*' == c)) {
+      *out++ = c;
     }
     else {
-      safe_snprintf(x, 3, "%.2x", src->data[n]);
-      bconchar(dst, '%');
-      bconchar(dst, x[0]);
-      bconchar(dst, x[1]);
+      *out++ = '%';
+      *out++ = hex[c >> 4];
+      *out++ = hex[c & 0xf];
     }
   }
+  *out = 0;
+  dst->slen = out - dst->data;
   return 0;
 }
 
+/* Encode src as urlencoded and place null terminated result in dst */
+int redir_urlencode(bstring src, bstring dst) {
+  bassigncstr(dst, "");
+  return redir_urlencode_cat(dst, (char *)src->data, src->slen);
+}
+
+/* Append "<amp><name>=<urlencoded value>" to dst */
+static void redir_urlparam(bstring dst, char *amp, char *name, char *value) {
+  bcatcstr(dst, amp);
+  bcatcstr(dst, name);
+  bconchar(dst, '=');
+  redir_urlencode_cat(dst, value, strlen(value));
+}
+
 /* Decode urlencoded src and place null terminated result in dst */
 int redir_urldecode(bstring src, bstring dst) {
   char x[3];
@@ -407,24 +429,207 @@ static int base64decoder (char * eapstr, struct eapmsg_t * eapmsg)
   return 0;
 }
 
+static void redir_md_final(MD5_CTX *context, bstring str, 
+			   char *secret, char *amp) {
+  static const char hexdig[] = "0123456789ABCDEF";
+  unsigned char cksum[16];
+  char hex[32+1];
+  int i;
+
+  MD5Update(context, (uint8_t *)secret, strlen(secret));
+  MD5Final(cksum, context);
+  
+  for (i=0; i<16; i++) {
+    hex[2*i] = hexdig[cksum[i] >> 4];
+    hex[2*i+1] = hexdig[cksum[i] & 0xf];
+  }
+  hex[32] = 0;
+  
+  bcatcstr(str, amp);
+  bcatcstr(str, "md=");
+  bcatcstr(str, hex);
+}
+
+static void redir_urltpl_free(struct redir_urltpl_t *tpl) {
+  if (tpl->uam)    bdestroy(tpl->uam);
+  if (tpl->called) bdestroy(tpl->called);
+  if (tpl->nas)    bdestroy(tpl->nas);
+  if (tpl->vlan)   bdestroy(tpl->vlan);
+  if (tpl->ssl)    bdestroy(tpl->ssl);
+  if (tpl->probe)  bdestroy(tpl->probe);
+  memset(tpl, 0, sizeof(*tpl));
+}
+
+/* Well-known operating system captive portal detection probes */
+static struct {
+  char *host;
+  char *path;
+} redir_probes[] = {
+  { "captive.apple.com",             "/" },
+  { "captive.apple.com",             "/hotspot-detect.html" },
+  { "www.apple.com",                 "/library/test/success.html" },
+  { "connectivitycheck.gstatic.com", "/generate_204" },
+  { "connectivitycheck.android.com", "/generate_204" },
+  { "clients3.google.com",           "/generate_204" },
+  { "www.msftconnecttest.com",       "/connecttest.txt" },
+  { "www.msftncsi.com",              "/ncsi.txt" },
+  { "detectportal.firefox.com",      "/success.txt" },
+  { "detectportal.firefox.com",      "/canonical.html" },
+  { "nmcheck.gnome.org",             "/check_network_status.txt" },
+  { 0, 0 }
+};
+
+/*
+ *  Classify a complete, null terminated, raw HTTP request header
+ *  as a captive portal probe without parsing it into httpreq.
+ */
+static int redir_probe_match(char *buf) {
+  char *path, *host = 0, *p;
+  size_t plen, hlen;
+  int i;
+
+  if      (!strncmp(buf, "GET ",  4)) path = buf + 4;
+  else if (!strncmp(buf, "HEAD ", 5)) path = buf + 5;
+  else return 0;
+
+  if (!strncmp(path, "http://", 7)) {
+    path += 7;
+    while (*path && *path != '/' && *path != ' ') path++;
+  }
+
+  plen = strcspn(path, "? \r\n");
+
+  for (p = strstr(path, "\r\n"); p; p = strstr(p, "\r\n")) {
+    p += 2;
+    if (p[0] == '\r' && p[1] == '\n')
+      break;
+    if (!strncasecmp(p, "Host:", 5)) {
+      host = p + 5;
+      while (*host == ' ' || *host == '\t') host++;
+    }
+  }
+
+  /* only a complete request header is answered */
+  if (!p || !host) 
+    return 0;
+
+  hlen = strcspn(host, ": \t\r\n");
+
+  for (i=0; redir_probes[i].host; i++) {
+    if (strlen(redir_probes[i].host) == hlen &&
+	!strncasecmp(host, redir_probes[i].host, hlen) &&
+	strlen(redir_probes[i].path) == plen &&
+	!strncmp(path, redir_probes[i].path, plen)) {
+      log_dbg("captive portal probe %s%s", 
+	      redir_probes[i].host, redir_probes[i].path);
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/* Precompile the configuration dependent parts of the portal URL */
+static void redir_urltpl_build(struct redir_t *redir) {
+  struct redir_urltpl_t *tpl = &redir->urltpl;
+  char buf[128];
+
+  redir_urltpl_free(tpl);
+
+  tpl->uam = bfromcstr("");
+  bassignformat(tpl->uam, "&uamip=%s&uamport=%d", 
+		inet_ntoa(redir->addr), redir->port);
+
+  tpl->called = bfromcstr("");
+  if (_options.nasmac)
+    safe_strncpy(buf, _options.nasmac, sizeof(buf));
+  else 
+    safe_snprintf(buf, sizeof(buf), "%.2X-%.2X-%.2X-%.2X-%.2X-%.2X", 
+		  redir->nas_hwaddr[0], redir->nas_hwaddr[1], 
+		  redir->nas_hwaddr[2], redir->nas_hwaddr[3], 
+		  redir->nas_hwaddr[4], redir->nas_hwaddr[5]);
+  redir_urlparam(tpl->called, "&", "called", buf);
+
+  tpl->nas = bfromcstr("");
+  if (redir->ssid)
+    redir_urlparam(tpl->nas, "&", "ssid", redir->ssid);
+  if (_options.radiusnasid)
+    redir_urlparam(tpl->nas, "&", "nasid", _options.radiusnasid);
+
+  tpl->vlan = bfromcstr("");
+  if (redir->vlan)
+    redir_urlparam(tpl->vlan, "&", "vlan", redir->vlan);
+
+  tpl->ssl = bfromcstr("");
+#ifdef ENABLE_UAMUIPORT
+  if (_options.uamuissl && _options.uamuiport) {
+    /*
+     *  When we have uamuissl, a key/cert, and a uamuiport,
+     *  then let's inform the captive portal of an SSL enabled
+     *  services. 
+     */
+    if (_options.uamaliasname && _options.domain) {
+      safe_snprintf(buf, sizeof(buf), "https://%s.%s:%d/", 
+		    _options.uamaliasname,
+		    _options.domain,
+		    _options.uamuiport);
+    } else {
+      safe_snprintf(buf, sizeof(buf), "https://%s:%d/", 
+		    inet_ntoa(_options.uamalias),
+		    _options.uamuiport);
+    }
+    redir_urlparam(tpl->ssl, "&", "ssl", buf);
+  }
+#endif
+
+  if (_options.redirprobe) {
+    /*
+     *  Probes are sent to /prelogin on the uamport, which does
+     *  the session lookup and the real portal redirect.
+     */
+    tpl->probe = bfromcstralloc(512, "");
+    redir_http(tpl->probe, "302 Moved Temporarily", 0);
+    bformata(tpl->probe, 
+	     "Location: http://%s:%d/prelogin\r\n"
+	     "Content-Type: text/html; charset=UTF-8\r\n"
+	     "Content-Length: 0\r\n"
+	     "\r\n", inet_ntoa(redir->addr), redir->port);
+  }
+
+  /*
+   *  Nearly every redirect goes to the configured uamserver, so
+   *  keep the MD5 state of its URL and separator to resume from.
+   */
+  if (redir->url) {
+    tpl->url = redir->url;
+    tpl->mdlen = strlen(redir->url);
+    MD5Init(&tpl->mdctx);
+    MD5Update(&tpl->mdctx, (uint8_t *)redir->url, tpl->mdlen);
+    MD5Update(&tpl->mdctx, (uint8_t *)
+	      (strchr(redir->url, '?') ? "&" : "?"), 1);
+    tpl->mdlen++;
+  }
+}
+
 static void bstring_buildurl(bstring str, struct redir_conn_t *conn,
 			     struct redir_t *redir, char *redir_url, char *resp,
 			     long int timeleft, char* hexchal, char* uid, 
 			     char* userurl, char* reply, char* redirurl,
-			     uint8_t *hismac, struct in_addr *hisip, char *amp) {
-  bstring bt = bfromcstr("");
-  bstring bt2 = bfromcstr("");
+			     uint8_t *hismac, struct in_addr *hisip) {
+  struct redir_urltpl_t *tpl = &redir->urltpl;
 
-  bassignformat(str, "%s%sres=%s%suamip=%s%suamport=%d", 
-		redir_url, strchr(redir_url, '?') ? amp : "?", resp, amp,
-		inet_ntoa(redir->addr), amp,
-		redir->port);
+  if (!tpl->uam)
+    redir_urltpl_build(redir);
+
+  bassigncstr(str, redir_url);
+  bconchar(str, strchr(redir_url, '?') ? '&' : '?');
+  bcatcstr(str, "res=");
+  bcatcstr(str, resp);
+  bconcat(str, tpl->uam);
 
   if (hexchal) {
-    bcatcstr(str, amp);
-    bassignformat(bt, "challenge=%s", hexchal);
-    bconcat(str, bt);
-    bassigncstr(bt,"");
+    bcatcstr(str, "&challenge=");
+    bcatcstr(str, hexchal);
   }
   
   if (conn->type == REDIR_STATUS) {
@@ -435,221 +640,116 @@ static void bstring_buildurl(bstring str, struct redir_conn_t *conn,
 
       sessiontime = timenow - starttime;
 
-      bcatcstr(str, amp);
-      bassignformat(bt, "starttime=%ld", starttime);
-      bconcat(str, bt);
-      bcatcstr(str, amp);
-      bassignformat(bt, "sessiontime=%ld", sessiontime);
-      bconcat(str, bt);
+      bformata(str, "&starttime=%ld&sessiontime=%ld", 
+	       (long)starttime, (long)sessiontime);
     }
 
     if (conn->s_params.sessiontimeout) {
-      bcatcstr(str, amp);
-      bassignformat(bt, "sessiontimeout=%ld", conn->s_params.sessiontimeout);
-      bconcat(str, bt);
+      bformata(str, "&sessiontimeout=%ld", 
+	       (long)conn->s_params.sessiontimeout);
     }
 
     if (conn->s_params.sessionterminatetime) {
-      bcatcstr(str, amp);
-      bassignformat(bt, "stoptime=%ld", conn->s_params.sessionterminatetime);
-      bconcat(str, bt);
+      bformata(str, "&stoptime=%ld", 
+	       (long)conn->s_params.sessionterminatetime);
     }
   }
  
-  bcatcstr(str, amp);
-  bcatcstr(str, "called=");
-  if (_options.nasmac)
-    bassigncstr(bt, _options.nasmac);
-  else 
-    bassignformat(bt, "%.2X-%.2X-%.2X-%.2X-%.2X-%.2X", 
-		  redir->nas_hwaddr[0], redir->nas_hwaddr[1], redir->nas_hwaddr[2],
-		  redir->nas_hwaddr[3], redir->nas_hwaddr[4], redir->nas_hwaddr[5]);
-
-  redir_urlencode(bt, bt2);
-  bconcat(str, bt2);
+  bconcat(str, tpl->called);
 
   if (uid) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "uid=");
-    bassigncstr(bt, uid);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
+    redir_urlparam(str, "&", "uid", uid);
   }
 
   if (timeleft) {
-    bcatcstr(str, amp);
-    bassignformat(bt, "timeleft=%ld", timeleft);
-    bconcat(str, bt);
+    bformata(str, "&timeleft=%ld", timeleft);
   }
   
   if (hismac) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "mac=");
-    bassignformat(bt, "%.2X-%.2X-%.2X-%.2X-%.2X-%.2X",
-		  hismac[0], hismac[1], 
-		  hismac[2], hismac[3],
-		  hismac[4], hismac[5]);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
+    /* hex digits and '-' are left alone by the url encoding */
+    bformata(str, "&mac=%.2X-%.2X-%.2X-%.2X-%.2X-%.2X",
+	     hismac[0], hismac[1], 
+	     hismac[2], hismac[3],
+	     hismac[4], hismac[5]);
   }
 
   if (hisip) {
-    bcatcstr(str, amp);
-    bassignformat(bt, "ip=%s", inet_ntoa(*hisip));
-    bconcat(str, bt);
+    bcatcstr(str, "&ip=");
+    bcatcstr(str, inet_ntoa(*hisip));
   }
 
   if (reply) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "reply=");
-    bassigncstr(bt, reply);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
+    redir_urlparam(str, "&", "reply", reply);
   }
 
-  if (redir->ssid) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "ssid=");
-    bassigncstr(bt, redir->ssid);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
-  }
-
-  if (_options.radiusnasid) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "nasid=");
-    bassigncstr(bt, _options.radiusnasid);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
-  }
+  bconcat(str, tpl->nas);
 
 #ifdef ENABLE_IEEE8021Q
   if (_options.ieee8021q && conn->s_state.tag8021q) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "vlan=");
-    bassignformat(bt, "%d", 
-		  (int)ntohs(conn->s_state.tag8021q & 
-			     PKT_8021Q_MASK_VID));
-    bconcat(str, bt);
+    bformata(str, "&vlan=%d", 
+	     (int)ntohs(conn->s_state.tag8021q & 
+			PKT_8021Q_MASK_VID));
   } else 
 #endif
 #ifdef ENABLE_MULTILAN
   if (conn->s_state.lanidx > 0) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "vlan=");
-    bassignformat(bt, "%s", 
-		  _options.moreif[conn->s_state.lanidx-1].vlan ?
-		  _options.moreif[conn->s_state.lanidx-1].vlan :
-		  _options.moreif[conn->s_state.lanidx-1].dhcpif);
-    bconcat(str, bt);
+    bcatcstr(str, "&vlan=");
+    bcatcstr(str, 
+	     _options.moreif[conn->s_state.lanidx-1].vlan ?
+	     _options.moreif[conn->s_state.lanidx-1].vlan :
+	     _options.moreif[conn->s_state.lanidx-1].dhcpif);
   } else
 #endif
-  if (redir->vlan) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "vlan=");
-    bassigncstr(bt, redir->vlan);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
-  }
+  bconcat(str, tpl->vlan);
 
 #ifdef ENABLE_LOCATION
   if (conn->s_state.location[0]) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "loc=");
-    bassigncstr(bt, conn->s_state.location);
-    redir_urlencode(bt, bt2);
-    
-    log_dbg("found %.*s",
-	    bt->slen, bt->data);
-    
-    bconcat(str, bt2);
+    log_dbg("found %s", conn->s_state.location);
+    redir_urlparam(str, "&", "loc", conn->s_state.location);
   }
 #endif
 
   if (conn->lang[0]) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "lang=");
-    bassigncstr(bt, conn->lang);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
+    redir_urlparam(str, "&", "lang", conn->lang);
   }
 
   if (conn->s_state.sessionid[0]) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "sessionid=");
-    bassigncstr(bt, conn->s_state.sessionid);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
+    redir_urlparam(str, "&", "sessionid", conn->s_state.sessionid);
   }
 
-#ifdef ENABLE_UAMUIPORT
-  if (_options.uamuissl && _options.uamuiport) {
-    /*
-     *  When we have uamuissl, a key/cert, and a uamuiport,
-     *  then let's inform the captive portal of an SSL enabled
-     *  services. 
-     */
-    bcatcstr(str, amp);
-    bcatcstr(str, "ssl=");
-    if (_options.uamaliasname && _options.domain) {
-      bassignformat(bt, "https://%s.%s:%d/", 
-                    _options.uamaliasname,
-                    _options.domain,
-                    _options.uamuiport);
-    } else {
-      bassignformat(bt, "https://%s:%d/", 
-                    inet_ntoa(_options.uamalias),
-                    _options.uamuiport);
-    }
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
-  }
-#endif
+  bconcat(str, tpl->ssl);
 
   if (_options.redirurl && redirurl) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "redirurl=");
-    bassigncstr(bt, redirurl);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
+    redir_urlparam(str, "&", "redirurl", redirurl);
   }
 
   if (userurl) {
-    bcatcstr(str, amp);
-    bcatcstr(str, "userurl=");
-    bassigncstr(bt, userurl);
-    redir_urlencode(bt, bt2);
-    bconcat(str, bt2);
+    redir_urlparam(str, "&", "userurl", userurl);
   }
 
   if (redir->secret && *redir->secret) { 
     /* take the md5 of the url+uamsecret as a checksum */
-    redir_md_param(str, redir->secret, amp);
-  }
+    MD5_CTX context;
 
-  bdestroy(bt);
-  bdestroy(bt2);
+    if (redir_url == tpl->url && str->slen >= tpl->mdlen) {
+      context = tpl->mdctx;
+      MD5Update(&context, (uint8_t *)str->data + tpl->mdlen, 
+		str->slen - tpl->mdlen);
+    } else {
+      MD5Init(&context);
+      MD5Update(&context, (uint8_t *)str->data, str->slen);
+    }
+
+    redir_md_final(&context, str, redir->secret, "&");
+  }
 }
 
 int redir_md_param(bstring str, char *secret, char *amp) {
   MD5_CTX context;
-  unsigned char cksum[16];
-  char hex[32+1];
-  int i;
 
   MD5Init(&context);
   MD5Update(&context, (uint8_t *)str->data, str->slen);
-  MD5Update(&context, (uint8_t *)secret, strlen(secret));
-  MD5Final(cksum, &context);
-  
-  hex[0]=0;
-  for (i=0; i<16; i++) {
-    safe_snprintf(hex+2*i, 3, "%.2X", cksum[i]);
-  }
-  
-  bcatcstr(str, amp);
-  bcatcstr(str, "md=");
-  bcatcstr(str, hex);
+  redir_md_final(&context, str, secret, amp);
   return 0;
 }
 
@@ -1261,7 +1361,7 @@ void redir_wispr2_reply (struct redir_t *redir, struct redir_conn_t *conn,
 static int redir_json_reply(struct redir_t *redir, int res, struct redir_conn_t *conn,  
 			    char *hexchal, char *userurl, char *redirurl, 
 			    uint8_t *hismac, struct in_addr *hisip,
-			    char *reply, char *qs, bstring s) {
+			    char *reply, char *qs, char keepalive, bstring s) {
   bstring tmp = bfromcstr("");
   bstring json = bfromcstr("");
 
@@ -1377,7 +1477,7 @@ static int redir_json_reply(struct redir_t *redir, int res, struct redir_conn_t
     bcatcstr(json, ")");
   }
 
-  redir_http(s, "200 OK");
+  redir_http(s, "200 OK", keepalive);
 
   bcatcstr(s, "Content-Length: ");
   bassignformat(tmp , "%d", blength(json));
@@ -1416,7 +1516,7 @@ static void redir_buildurl(struct redir_conn_t *conn, bstring str,
   }
   
   bstring_buildurl(str, conn, redir, redir_url, resp, timeleft, 
-		   hexchal, uid, userurl, reply, redirurl, hismac, hisip, "&");
+		   hexchal, uid, userurl, reply, redirurl, hismac, hisip);
 }
 
 ssize_t
@@ -1458,10 +1558,21 @@ redir_write(struct redir_socket_t *sock, char *buf, size_t len) {
   while (r < len) {
 #ifdef HAVE_SSL
     if (sock->sslcon) {
-      c = openssl_write(sock->sslcon, buf, len, 0);
+      c = openssl_write(sock->sslcon, buf+r, len-r, 0);
     } else 
 #endif
-    {
+    if (sock->obuf) {
+      /* Queue what the socket would block on, behind anything queued */
+      if (!sock->obuf->slen) {
+	c = safe_write(sock->fd[1], buf+r, len-r);
+	if (c < 0 && errno != EWOULDBLOCK && errno != EAGAIN)
+	  return (ssize_t) r;
+	if (c > 0) r += (size_t)c;
+      }
+      if (r < len)
+	bcatblk(sock->obuf, buf+r, len-r);
+      return (ssize_t) len;
+    } else {
       c = tcp_write_timeout(timeout, sock, buf+r, len-r);
     }
     if (c <= 0) return (ssize_t) r;
@@ -1539,7 +1650,7 @@ int redir_reply(struct redir_t *redir, struct redir_socket_t *sock,
   if (conn->format == REDIR_FMT_JSON) {
 
     redir_json_reply(redir, res, conn, hexchal, userurl, redirurl, 
-		     hismac, hisip, reply, qs, buffer);
+		     hismac, hisip, reply, qs, sock->keepalive, buffer);
     
   } else 
 #endif
@@ -1547,7 +1658,7 @@ int redir_reply(struct redir_t *redir, struct redir_socket_t *sock,
     bstring bt;
     bstring bbody;
 
-    redir_http(buffer, "302 Moved Temporarily");
+    redir_http(buffer, "302 Moved Temporarily", sock->keepalive);
     bcatcstr(buffer, "Location: ");
     
     if (url) {
@@ -1611,7 +1722,9 @@ int redir_reply(struct redir_t *redir, struct redir_socket_t *sock,
     bdestroy(bt);
     
   } else {
-    redir_http(buffer, "200 OK");
+    /* unframed, the end of the reply is the end of the connection */
+    sock->keepalive = 0;
+    redir_http(buffer, "200 OK", 0);
     bcatcstr(buffer, 
 	     "Content-type: text/html\r\n\r\n"
 	     "<HTML><HEAD><TITLE>CoovaChilli</TITLE></HEAD><BODY>");
@@ -1625,6 +1738,8 @@ int redir_reply(struct redir_t *redir, struct redir_socket_t *sock,
     return -1;
   }
 
+  sock->persist = sock->keepalive;
+
   bdestroy(buffer);
   return 0;
 }
@@ -1757,7 +1872,7 @@ int redir_ipc(struct redir_t *redir) {
   struct sockaddr_un local;
   int sock;
   
-  if ((sock = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
+  if ((sock = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1) {
 
     log_err(errno, "could not allocate UNIX Socket!");
 
@@ -1779,8 +1894,8 @@ int redir_ipc(struct redir_t *redir) {
       safe_close(sock);
       sock = -1;
     } else {
-      if (listen(sock, 128) == -1) {
-	log_err(errno, "could listen to UNIX Socket!");
+      if (ndelay_on(sock) == -1) {
+	log_err(errno, "could not set UNIX Socket non-blocking!");
 	safe_close(sock);
 	sock = -1;
       } else {
@@ -1839,6 +1954,7 @@ int redir_free(struct redir_t *redir) {
   }
 #endif
   
+  redir_urltpl_free(&redir->urltpl);
   free(redir);
   return 0;
 }
@@ -1860,6 +1976,8 @@ void redir_set(struct redir_t *redir, uint8_t *hwaddr, int debug) {
     memcpy(redir->nas_hwaddr, hwaddr, sizeof(redir->nas_hwaddr));
   }
 
+  redir_urltpl_build(redir);
+
   return;
 }
 
@@ -1905,6 +2023,219 @@ int redir_getparam(struct redir_t *redir, char *src, char *param, bstring dst) {
   return 0;
 }
 
+/*
+ *  Look for the empty line ending the request header, resuming at
+ *  *scan so that bytes from earlier partial reads are not searched
+ *  again. Returns the length of the header, or 0 if incomplete.
+ */
+static size_t redir_http_eoh(char *buf, size_t len, size_t *scan) {
+  size_t i = *scan > 3 ? *scan - 3 : 0;
+  char *p;
+
+  *scan = len;
+
+  while (i + 3 < len) {
+    if (!(p = memchr(buf + i, '\r', len - i - 3)))
+      break;
+    i = p - buf;
+    if (p[1] == '\n' && p[2] == '\r' && p[3] == '\n')
+      return i + 4;
+    i++;
+  }
+
+  return 0;
+}
+
+static void redir_http_copy(char *dst, size_t dstlen, char *src, size_t len) {
+  if (len >= dstlen) len = dstlen - 1;
+  memcpy(dst, src, len);
+  dst[len] = 0;
+}
+
+/*
+ *  Parse hlen bytes of request header in a single pass. Lines are
+ *  walked in place and only the fields kept are copied out. Returns
+ *  1 when the request type needs no further processing.
+ */
+static int redir_http_parse(struct redir_conn_t *conn, 
+			    struct redir_httpreq_t *httpreq,
+			    char *buf, size_t hlen) {
+  char *line = buf, *end = buf + hlen;
+  char *path = httpreq->path;
+  int lines = 0, fin = 0;
+
+  while (line < end) {
+    char *eol = memchr(line, '\n', end - line);
+    char *le;
+
+    if (!eol) eol = end;
+    le = eol;
+    if (le > line && le[-1] == '\r') le--;
+
+    if (lines++ == 0) { /* first line */
+      char *p1 = line;
+      char *p2;
+      
+      if      (le - p1 > 4 && !strncmp("GET ",  p1, 4)) { p1 += 4; }
+      else if (le - p1 > 5 && !strncmp("HEAD ", p1, 5)) { p1 += 5; }
+      else if (httpreq->allow_post && 
+	       le - p1 > 5 && !strncmp("POST ", p1, 5)) { 
+	p1 += 5; 
+	httpreq->is_post = 1; 
+      } else { 
+	log_dbg("Unhandled http request: %.*s %d", (int)(le - line), line,
+		_options.uamallowpost);
+	return -1;
+      }
+      
+      while (p1 < le && *p1 == ' ') p1++; /* Advance through additional white space */
+      
+      if (le - p1 > 8 && !strncmp(p1, "http://", 7)) {
+	/*
+	 *   A proxy request, skip over the initial URL
+	 */
+	p1 += 7;
+	while (p1 < le && *p1 != '/') p1++;
+      }
+      
+      if (p1 < le && *p1 == '/') p1++;
+      else { log_err(0, "parse error"); return -1; }
+      
+      /* The path ends with a ? or a space */
+      for (p2 = p1; p2 < le && *p2 != '?' && *p2 != ' '; p2++);
+      if (p2 == le) { log_err(0, "parse error"); return -1; }
+      
+      redir_http_copy(path, sizeof(httpreq->path), p1, p2 - p1);
+      
+      log_dbg("The path: %s", path); 
+      
+      /* TODO: Should also check the Host: to make sure we are talking directly to uamlisten */
+      
+#ifdef ENABLE_JSON
+      if (!strncmp(path, "json/", 5) && strlen(path) > 6) {
+	int i, last=strlen(path)-5;
+	
+	conn->format = REDIR_FMT_JSON;
+	
+	for (i=0; i < last; i++)
+	  path[i] = path[i+5];
+	
+	path[last]=0;
+	
+	log_dbg("The (json format) path: %s", path); 
+      } 
+#endif
+      
+      if ((!strcmp(path, "logon")) || (!strcmp(path, "login")))
+	conn->type = REDIR_LOGIN;
+      else if ((!strcmp(path, "logoff")) || (!strcmp(path, "logout")))
+	conn->type = REDIR_LOGOUT;
+      else if (!strncmp(path, "www/", 4) && strlen(path) > 4)
+	conn->type = REDIR_WWW;
+      else if (!strcmp(path, "status"))
+	conn->type = REDIR_STATUS;
+      else if (!strncmp(path, "msdownload", 10))
+	{ conn->type = REDIR_MSDOWNLOAD; fin = 1; }
+      else if (!strcmp(path, "prelogin"))
+	{ conn->type = REDIR_PRELOGIN; fin = 1; }
+      else if (!strcmp(path, "macreauth"))
+	{ conn->type = REDIR_MACREAUTH; fin = 1; }
+      else if (!strcmp(path, "abort"))
+	{ conn->type = REDIR_ABORT; fin = 1; }
+#ifdef ENABLE_EWTAPI
+      else if (!strncmp(path, "ewt/json", 8))
+	conn->type = REDIR_EWTAPI;
+#endif
+      
+      /* HTTP/1.1 connections persist unless the client says otherwise */
+      if (le - line > 8 && !strncmp(le - 8, "HTTP/1.1", 8))
+	httpreq->keepalive = 1;
+      
+      if (*p2 == '?') {
+	p1 = p2 + 1;
+	for (p2 = p1; p2 < le && *p2 != ' '; p2++);
+	
+	if (p2 < le) {
+	  redir_http_copy(httpreq->qs, sizeof(httpreq->qs), p1, p2 - p1);
+	  
+#if(_debug_ > 1)
+	  log_dbg("Query string: %s", httpreq->qs); 
+#endif
+	}
+      }
+    } else if (le == line) { 
+      /* end of headers */
+#if(_debug_ > 1)    
+      log_dbg("end of http-request");
+#endif
+      break;
+    } else { 
+      /* headers */
+      char *p;
+      
+#define redir_http_hdr(name) \
+      (le - line >= (int)sizeof(name) - 1 && \
+       !strncasecmp(line, name, sizeof(name) - 1) && \
+       (p = line + sizeof(name) - 1))
+      
+      if (redir_http_hdr("Host:")) {
+	while (p < le && isspace((int) *p)) p++;
+	redir_http_copy(httpreq->host, sizeof(httpreq->host), p, le - p);
+#if(_debug_ > 1)
+	log_dbg("Host: %s",httpreq->host);
+#endif
+      } 
+      else if (redir_http_hdr("Content-Length:")) {
+	while (p < le && isspace((int) *p)) p++;
+	if (p < le) httpreq->clen = atoi(p);
+#if(_debug_ > 1)
+	log_dbg("Content-Length: %d",(int)httpreq->clen);
+#endif
+      }
+#ifdef ENABLE_USERAGENT
+      else if (redir_http_hdr("User-Agent:")) {
+	while (p < le && isspace((int) *p)) p++;
+	redir_http_copy(conn->s_state.redir.useragent, 
+			sizeof(conn->s_state.redir.useragent), p, le - p);
+#if(_debug_)
+	log_dbg("User-Agent: %s",conn->s_state.redir.useragent);
+#endif
+      }
+#endif
+#ifdef ENABLE_ACCEPTLANGUAGE
+      else if (redir_http_hdr("Accept-Language:")) {
+	while (p < le && isspace((int) *p)) p++;
+	redir_http_copy(conn->s_state.redir.acceptlanguage, 
+			sizeof(conn->s_state.redir.acceptlanguage), p, le - p);
+#if(_debug_ > 1)
+	log_dbg("Accept-Language: %s",conn->s_state.redir.acceptlanguage);
+#endif
+      }
+#endif
+      else if (redir_http_hdr("Connection:")) {
+	while (p < le && isspace((int) *p)) p++;
+	if (le - p >= 5 && !strncasecmp(p, "close", 5))
+	  httpreq->keepalive = 0;
+	else if (le - p >= 10 && !strncasecmp(p, "keep-alive", 10))
+	  httpreq->keepalive = 1;
+      }
+      else if (redir_http_hdr("Cookie:")) {
+	while (p < le && isspace((int) *p)) p++;
+	redir_http_copy(conn->httpcookie, sizeof(conn->httpcookie), p, le - p);
+#if(_debug_ > 1)
+	log_dbg("Cookie: %s",conn->httpcookie);
+#endif
+      }
+
+#undef redir_http_hdr
+    }
+
+    line = eol + 1;
+  }
+
+  return fin;
+}
+
 /* Read the an HTTP request from a client */
 static int redir_getreq(struct redir_t *redir, struct redir_socket_t *sock,
 			struct redir_conn_t *conn, struct redir_httpreq_t *httpreq,
@@ -1916,21 +2247,29 @@ static int redir_getreq(struct redir_t *redir, struct redir_socket_t *sock,
   ssize_t recvlen = 0;
   size_t buflen = 0;
   char buffer[REDIR_MAXBUFFER];
-  int i, lines=0;
-  char *eol;
 
   char read_waiting;
 
-  char *path = httpreq->path;
-
   char forked = (rreq == 0);
 
-  char wblock = 0, done = 0, eoh = 0;
+  char wblock = 0, done = 0;
 
-  memset(buffer, 0, sizeof(buffer));
+  /* 
+   *  The header is parsed where it was read: the stack buffer when
+   *  forked, otherwise data_in which persists across partial reads.
+   */
+  char *hdr = buffer;
+  size_t hlen = 0, eoh = 0;
+  size_t lscan = 0, *scan = rreq ? &rreq->hscan : &lscan;
+
+  buffer[0] = 0;
+
+  if (httpreq->data_in && *scan > httpreq->data_in->slen)
+    *scan = 0;
   
   /* read whatever the client send to us */
-  while (!done && (redir->starttime + REDIR_HTTP_MAX_TIME) > mainclock_now()) {
+  while (!done && !eoh && 
+	 (redir->starttime + REDIR_HTTP_MAX_TIME) > mainclock_now()) {
 
     read_waiting = 0;
 
@@ -2046,194 +2385,48 @@ static int redir_getreq(struct redir_t *redir, struct redir_socket_t *sock,
       if (httpreq->data_in->slen >= sizeof(buffer)) {
 	log_err(0, "buffer too long (%d)", httpreq->data_in->slen);
 	return -1;
-      } else {
-	buflen = httpreq->data_in->slen;
-	memcpy(buffer, httpreq->data_in->data, buflen);
-	buffer[buflen] = 0;
       }
+      hdr = (char *)httpreq->data_in->data;
+      hlen = httpreq->data_in->slen;
+    } else {
+      hlen = buflen;
     }
     
-    if (buflen == 0) {
+    if (hlen == 0) {
       log_dbg("No data in HTTP request!");
       if (!forked && wblock) return 1;
       return -1;
     }
 
-    while ((eol = strstr(buffer, "\r\n"))) {
-      size_t linelen = eol - buffer;
-      *eol = 0;
-      
-      if (lines++ == 0) { /* first line */
-	char *p1 = buffer;
-	char qs_delim = '?';
-	char *p2;
-	
-	if      (!strncmp("GET ",  p1, 4)) { p1 += 4; }
-	else if (!strncmp("HEAD ", p1, 5)) { p1 += 5; }
-	else if (httpreq->allow_post && !strncmp("POST ", p1, 5)) { 
-	  p1 += 5; 
-	  httpreq->is_post = 1; 
-	} else { 
-	  log_dbg("Unhandled http request: %s %d", p1, 
-		  _options.uamallowpost);
-	  return -1;
-	}
-
-	while (*p1 == ' ') p1++; /* Advance through additional white space */
-
-	if (!strncmp(p1, "http://", 7) && strlen(p1) > 8) {
-	  /*
-	   *   A proxy request, skip over the initial URL
-	   */
-	  p1 += 7;
-	  while (*p1 && *p1 != '/') p1++;
-	}
-
-	if (*p1 == '/') p1++;
-	else { log_err(0, "parse error"); return -1; }
-	
-	/* The path ends with a ? or a space */
-	p2 = strchr(p1, qs_delim);
-	if (!p2) { qs_delim = ' '; p2 = strchr(p1, qs_delim); }
-	if (!p2) { log_err(0, "parse error"); return -1; }
-	*p2 = 0;
-
-	safe_strncpy(path, p1, sizeof(httpreq->path));
-
-	log_dbg("The path: %s", path); 
-
-	/* TODO: Should also check the Host: to make sure we are talking directly to uamlisten */
-
-#ifdef ENABLE_JSON
-	if (!strncmp(path, "json/", 5) && strlen(path) > 6) {
-	  int i, last=strlen(path)-5;
-	  
-	  conn->format = REDIR_FMT_JSON;
-	  
-	  for (i=0; i < last; i++)
-	    path[i] = path[i+5];
-	  
-	  path[last]=0;
-	  
-	  log_dbg("The (json format) path: %s", path); 
-	} 
-#endif
-
-	if ((!strcmp(path, "logon")) || (!strcmp(path, "login")))
-	  conn->type = REDIR_LOGIN;
-	else if ((!strcmp(path, "logoff")) || (!strcmp(path, "logout")))
-	  conn->type = REDIR_LOGOUT;
-	else if (!strncmp(path, "www/", 4) && strlen(path) > 4)
-	  conn->type = REDIR_WWW;
-	else if (!strcmp(path, "status"))
-	  conn->type = REDIR_STATUS;
-	else if (!strncmp(path, "msdownload", 10))
-	  { conn->type = REDIR_MSDOWNLOAD; return 0; }
-	else if (!strcmp(path, "prelogin"))
-	  { conn->type = REDIR_PRELOGIN; return 0; }
-	else if (!strcmp(path, "macreauth"))
-	  { conn->type = REDIR_MACREAUTH; return 0; }
-	else if (!strcmp(path, "abort"))
-	  { conn->type = REDIR_ABORT; return 0; }
-#ifdef ENABLE_EWTAPI
-	else if (!strncmp(path, "ewt/json", 8))
-	  conn->type = REDIR_EWTAPI;
-#endif
+    eoh = redir_http_eoh(hdr, hlen, scan);
 
-	if (qs_delim == '?') {
-	  p1 = p2 + 1;
-	  p2 = strchr(p1, ' ');
-
-	  if (p2) {
-	    *p2 = 0;
-
-	    safe_strncpy(httpreq->qs, p1, sizeof(httpreq->qs));
-
-#if(_debug_ > 1)
-	    log_dbg("Query string: %s", httpreq->qs); 
-#endif
-	  }
-	}
-      } else if (linelen == 0) { 
-	/* end of headers */
-#if(_debug_ > 1)    
-	log_dbg("end of http-request");
-#endif
-	done = 1;
-	eoh = 1;
-	break;
-      } else { 
-	/* headers */
-	char *p;
-	size_t len;
-
-	if (!strncasecmp(buffer,"Host:",5)) {
-	  p = buffer + 5;
-	  while (*p && isspace((int) *p)) p++;
-	  safe_strncpy(httpreq->host, p, sizeof(httpreq->host));
-#if(_debug_ > 1)
-	  log_dbg("Host: %s",httpreq->host);
-#endif
-	} 
-	else if (!strncasecmp(buffer,"Content-Length:",15)) {
-	  p = buffer + 15;
-	  while (*p && isspace((int) *p)) p++;
-	  len = strlen(p);
-	  if (len > 0) httpreq->clen = atoi(p);
-#if(_debug_ > 1)
-	  log_dbg("Content-Length: %s",p);
-#endif
-	}
-#ifdef ENABLE_USERAGENT
-	else if (!strncasecmp(buffer,"User-Agent:",11)) {
-	  p = buffer + 11;
-	  while (*p && isspace((int) *p)) p++;
-	  safe_strncpy(conn->s_state.redir.useragent, 
-		       p, sizeof(conn->s_state.redir.useragent));
-#if(_debug_)
-	  log_dbg("User-Agent: %s",conn->s_state.redir.useragent);
-#endif
-	}
-#endif
-#ifdef ENABLE_ACCEPTLANGUAGE
-	else if (!strncasecmp(buffer,"Accept-Language:",16)) {
-	  p = buffer + 16;
-	  while (*p && isspace((int) *p)) p++;
-	  safe_strncpy(conn->s_state.redir.acceptlanguage, 
-		       p, sizeof(conn->s_state.redir.acceptlanguage));
-#if(_debug_ > 1)
-	  log_dbg("Accept-Language: %s",conn->s_state.redir.acceptlanguage);
-#endif
-	}
-#endif
-	else if (!strncasecmp(buffer,"Cookie:",7)) {
-	  p = buffer + 7;
-	  while (*p && isspace((int) *p)) p++;
-	  safe_strncpy(conn->httpcookie, p, sizeof(conn->httpcookie));
-#if(_debug_ > 1)
-	  log_dbg("Cookie: %s",conn->httpcookie);
-#endif
-	}
-      }
-
-      /* shift buffer */
-      linelen += 2;
-      for (i = 0; i < (int)(buflen - linelen); i++)
-	buffer[i] = buffer[(int)linelen + i];
-
-      /*log_dbg("linelen=%d buflen=%d", linelen, buflen);*/
-      buflen -= linelen;
-    }
-
-    if (!forked && !eoh && wblock) {
+    if (!forked && !eoh && !done && wblock) {
 #if(_debug_ > 1)
       log_dbg("Didn't see end of headers, continue...");
 #endif
-      /*log_dbg("%.*s",httpreq->data_in->slen,httpreq->data_in->data);*/
       return 1;
     }
   }
 
+  if (hlen == 0) {
+    log_dbg("No data in HTTP request!");
+    return -1;
+  }
+
+  if (rreq) 
+    rreq->hlen = eoh ? eoh : hlen;
+
+  if (eoh && redir->urltpl.probe && redir_probe_match(hdr)) {
+    conn->type = REDIR_PROBE;
+    return 0;
+  }
+
+  switch (redir_http_parse(conn, httpreq, hdr, eoh ? eoh : hlen)) {
+  case -1: return -1;
+  case 1:  return 0;
+  default: break;
+  }
+
   switch(conn->type) {
 
   case REDIR_STATUS:
@@ -2395,7 +2588,7 @@ static int redir_getreq(struct redir_t *redir, struct redir_socket_t *sock,
 
   case REDIR_WWW:
     {
-      bstring bt = bfromcstr(path+4);
+      bstring bt = bfromcstr(httpreq->path+4);
       bstring bt2 = bfromcstr("");
       redir_urldecode(bt, bt2);
       bstrtocstr(bt2, conn->wwwfile, sizeof(conn->wwwfile));
@@ -2975,8 +3168,214 @@ int is_local_user(struct redir_t *redir, struct redir_conn_t *conn) {
   return match;
 }
 
+#ifdef REDIR_POOL
+/*
+ * In-process redirector. Rather than forking for every connection,
+ * accepted sockets are kept in a pool of redir_request, watched by an
+ * epoll set of their own (itself watched by the main select loop),
+ * and run through redir_main() non-forked as their data arrives. Only
+ * RADIUS logins and local content still fork, from redir_main(), as do
+ * SSL connections on the uamuiport.
+ * Replies that would block are queued and written out on EPOLLOUT.
+ */
+static redir_request * redir_pool = 0;
+static redir_request * redir_pool_free = 0;
+static int redir_pool_efd = -1;
+
+static int redir_pool_events(redir_request *req, int evts) {
+  struct epoll_event event;
+  memset(&event, 0, sizeof(event));
+  event.events = evts;
+  event.data.ptr = req;
+  return epoll_ctl(redir_pool_efd, EPOLL_CTL_MOD, req->socket_fd, &event);
+}
+
+static void redir_pool_close(redir_request *req) {
+#ifdef HAVE_SSL
+  if (req->sslcon) {
+    openssl_shutdown(req->sslcon, 2);
+    openssl_free(req->sslcon);
+    req->sslcon = 0;
+  }
+#endif
+  if (req->socket_fd) {
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    /* A forked child may still hold the socket */
+    epoll_ctl(redir_pool_efd, EPOLL_CTL_DEL, req->socket_fd, &event);
+    safe_close(req->socket_fd);
+    req->socket_fd = 0;
+  }
+  timer_del(&req->timer);
+  req->inuse = 0;
+  req->next = redir_pool_free;
+  redir_pool_free = req;
+}
+
+static void redir_pool_expire(struct timer_node *t) {
+  redir_request *req = timer_entry(t, redir_request, timer);
+  log_dbg("redir connection from %s timed out", 
+	  inet_ntoa(req->conn.peer.sin_addr));
+  redir_pool_close(req);
+}
+
+static void redir_pool_flush(redir_request *req) {
+  while (req->obuf->slen > 0) {
+    ssize_t w = safe_write(req->socket_fd, req->obuf->data, 
+			   req->obuf->slen);
+    if (w < 0) {
+      if (errno == EWOULDBLOCK || errno == EAGAIN) {
+	redir_pool_events(req, req->read_closed ? EPOLLOUT : 
+			  EPOLLIN | EPOLLOUT);
+	return;
+      }
+      log_dbg("redir write to %s failed", 
+	      inet_ntoa(req->conn.peer.sin_addr));
+      redir_pool_close(req);
+      return;
+    }
+    bdelete(req->obuf, 0, w);
+  }
+
+  /* Reply done and written */
+  if (req->read_closed)
+    redir_pool_close(req);
+  else
+    redir_pool_events(req, EPOLLIN);
+}
+
+static void redir_pool_process(struct redir_t *redir, redir_request *req) {
+  for (;;) {
+    switch (redir_main(redir, req->socket_fd, req->socket_fd,
+		       &req->conn.peer, &req->baddr, 
+		       req->uiidx, req)) {
+    case 1:
+#ifdef HAVE_SSL
+      if (req->sslcon && openssl_pending(req->sslcon) > 0)
+	continue;
+#endif
+      if (req->obuf->slen > 0)
+	redir_pool_flush(req);
+      return;
+    default:
+      /* Only the queued reply, if any, is left */
+      req->read_closed = 1;
+      redir_pool_flush(req);
+      return;
+    }
+  }
+}
+
+static int redir_pool_accept(struct redir_t *redir, int fd,
+			     struct sockaddr_in *address,
+			     struct sockaddr_in *baddress, int idx) {
+  redir_request *req = redir_pool_free;
+  struct epoll_event event;
+
+  if (!req) {
+    log_warn(0, "redir pool of %d connections is full", REDIR_POOL_SIZE);
+    return -1;
+  }
+
+  if (ndelay_on(fd) < 0) {
+    log_err(errno, "could not set ndelay");
+    return -1;
+  }
+
+  memset(&event, 0, sizeof(event));
+  event.events = EPOLLIN;
+  event.data.ptr = req;
+
+  if (epoll_ctl(redir_pool_efd, EPOLL_CTL_ADD, fd, &event)) {
+    log_err(errno, "could not watch redir socket %d", fd);
+    return -1;
+  }
+
+  redir_pool_free = req->next;
+  req->next = 0;
+
+  req->parent = redir;
+  req->inuse = 1;
+  req->read_closed = 0;
+  req->uiidx = idx;
+  req->socket_fd = fd;
+  memcpy(&req->conn.peer, address, sizeof(struct sockaddr_in));
+  memcpy(&req->baddr, baddress, sizeof(struct sockaddr_in));
+
+  if (req->wbuf) bassigncstr(req->wbuf, "");
+  else req->wbuf = bfromcstr("");
+  req->hscan = 0;
+  if (req->obuf) bassigncstr(req->obuf, "");
+  else req->obuf = bfromcstr("");
+
+  req->timer.cb = redir_pool_expire;
+  timer_add(&chilli_timers, &req->timer, mainclock_now() + REDIR_MAXTIME);
+
+  redir_pool_process(redir, req);
+  return 0;
+}
+
+/**
+ * redir_pool_init()
+ * Sets up the in-process redirector, returns the epoll descriptor
+ * for the main select loop to watch, or -1.
+ **/
+int redir_pool_init() {
+  int i;
+
+  if (redir_pool_efd >= 0)
+    return redir_pool_efd;
+
+  redir_pool = calloc(REDIR_POOL_SIZE, sizeof(redir_request));
+  if (!redir_pool) {
+    log_err(errno, "Out of memory!");
+    return -1;
+  }
+
+  if ((redir_pool_efd = epoll_create(REDIR_POOL_SIZE)) < 0) {
+    log_err(errno, "epoll_create()");
+    free(redir_pool);
+    redir_pool = 0;
+    return -1;
+  }
+
+  for (i = REDIR_POOL_SIZE - 1; i >= 0; i--) {
+    redir_pool[i].index = i;
+    redir_pool[i].next = redir_pool_free;
+    redir_pool_free = &redir_pool[i];
+  }
+
+  return redir_pool_efd;
+}
+
+/**
+ * redir_pool_run()
+ * Select callback, services the pool connections with activity.
+ **/
+int redir_pool_run(struct redir_t *redir, int idx) {
+  struct epoll_event events[MAX_SELECT];
+  int n, i;
+
+  n = safe_epoll_wait(redir_pool_efd, events, MAX_SELECT, 0);
+
+  for (i = 0; i < n; i++) {
+    redir_request *req = (redir_request *) events[i].data.ptr;
+
+    if (!req->inuse) 
+      continue;
+
+    if (req->read_closed || (events[i].events & EPOLLOUT))
+      redir_pool_flush(req);
+    else
+      redir_pool_process(redir, req);
+  }
+
+  return 0;
+}
+#endif
+
 /* redir_accept() does the following:
- 1) forks a child process
+ 1) forks a child process (unless served by the in-process pool)
  2) Accepts the tcp connection 
  3) Analyses a HTTP get request
  4) GET request can be one of the following:
@@ -3022,6 +3421,17 @@ int redir_accept(struct redir_t *redir, int idx) {
 
   radius_packet_id++;
 
+#ifdef REDIR_POOL
+  /* SSL replies are not queued, so those connections keep forking */
+  if (redir_pool && !_options.redirfork && 
+      !(idx == 1 && (_options.uamui || _options.uamuissl))) {
+    if (!redir_pool_accept(redir, new_socket, &address, &baddress, idx))
+      return 0;
+    log_warn(0, "forking for the redir connection from %s", 
+	     inet_ntoa(address.sin_addr));
+  }
+#endif
+
   /* This forks a new process. The child really should close all
      unused file descriptors and free memory allocated. This however
      is performed when the process exits, so currently we don't
@@ -3088,21 +3498,90 @@ static int _redir_close_exit(int infd, int outfd) {
 }
 
 #ifdef USING_IPC_UNIX
-int redir_send_msg(struct redir_t *this, struct redir_msg_t *msg) {
+/*
+ * Messages to chilli go over a datagram socket connected to chilli.ipc
+ * on first use and then kept, so a message costs one send() and chilli
+ * needs no accept(). AF_UNIX datagrams are reliable and keep their
+ * boundaries; a full chilli queue blocks the sender. Senders with an
+ * address of their own wait for chilli to acknowledge each message.
+ */
+static int redir_ipc_fd = -1;
+static char redir_ipc_named = 0;
+#if !defined(__linux__)
+static char redir_ipc_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+static void redir_ipc_unlink() {
+  if (redir_ipc_path[0]) {
+    unlink(redir_ipc_path);
+    redir_ipc_path[0] = 0;
+  }
+}
+#endif
+
+/* Forget the channel inherited from the parent, a child opens its own */
+static void redir_ipc_reset() {
+  if (redir_ipc_fd >= 0)
+    safe_close(redir_ipc_fd);
+  redir_ipc_fd = -1;
+  redir_ipc_named = 0;
+#if !defined(__linux__)
+  redir_ipc_path[0] = 0;
+#endif
+}
+
+/* Drop any answer left over from a request that timed out */
+static void redir_ipc_drain() {
+  char b;
+  if (redir_ipc_fd >= 0)
+    while (recv(redir_ipc_fd, &b, 1, MSG_DONTWAIT) >= 0);
+}
+
+static int redir_ipc_connect(int retry, int named) {
   struct sockaddr_un remote; 
-  size_t len = sizeof(remote);
+  size_t len;
   int s;
 
   char filedest[512];
 
+  if (redir_ipc_fd >= 0) {
+    if (!retry && (redir_ipc_named || !named)) return redir_ipc_fd;
+    safe_close(redir_ipc_fd);
+    redir_ipc_fd = -1;
+#if !defined(__linux__)
+    redir_ipc_unlink();
+#endif
+  }
+
   statedir_file(filedest, sizeof(filedest), _options.unixipc, "chilli.ipc");
 
-  if ((s = socket(AF_UNIX, SOCK_STREAM, 0)) == -1) {
-    perror("socket");
+  if ((s = socket(AF_UNIX, SOCK_DGRAM, 0)) == -1) {
+    log_err(errno, "socket()");
     return -1;
   }
 
+  memset(&remote, 0, sizeof(remote));
   remote.sun_family = AF_UNIX;
+
+  /* An address of our own, for chilli to answer to */
+#if defined(__linux__)
+  named = (bind(s, (struct sockaddr *)&remote, sizeof(sa_family_t)) == 0);
+#else
+  if (named) {
+    safe_snprintf(remote.sun_path, sizeof(remote.sun_path), 
+		  "%s.%d", filedest, (int) getpid());
+    unlink(remote.sun_path);
+    named = (bind(s, (struct sockaddr *)&remote, sizeof(remote)) == 0);
+    if (named) {
+      static char registered = 0;
+      safe_strncpy(redir_ipc_path, remote.sun_path, sizeof(redir_ipc_path));
+      if (!registered) {
+	atexit(redir_ipc_unlink);
+	registered = 1;
+      }
+    }
+  }
+#endif
+
   safe_strncpy(remote.sun_path, filedest,
 	       sizeof(remote.sun_path));
 
@@ -3117,15 +3596,82 @@ int redir_send_msg(struct redir_t *this, struct redir_msg_t *msg) {
     safe_close(s);
     return -1;
   }
-  
-  if (safe_write(s, msg, sizeof(*msg)) != sizeof(*msg)) {
-    log_err(errno, "could not write to %s", remote.sun_path);
-    safe_close(s);
+
+  redir_ipc_fd = s;
+  redir_ipc_named = named;
+  return s;
+}
+
+static int redir_ipc_send(struct redir_msg_t *msg, int named) {
+  int retry;
+
+  for (retry = 0; retry < 2; retry++) {
+    int s = redir_ipc_connect(retry, named);
+
+    if (s < 0) 
+      return -1;
+
+    if (safe_send(s, msg, sizeof(*msg), 0) == sizeof(*msg))
+      return s;
+
+    /* chilli may have been restarted, reconnect once */
+    if (errno != ECONNREFUSED && errno != ENOTCONN)
+      break;
+  }
+
+  log_err(errno, "could not send to chilli.ipc");
+  return -1;
+}
+
+int redir_send_msg(struct redir_t *this, struct redir_msg_t *msg) {
+  struct timeval tv;
+  char ack;
+  int s;
+
+  redir_ipc_drain();
+
+  if ((s = redir_ipc_send(msg, 0)) < 0)
+    return -1;
+
+  /* Unnamed, chilli has nowhere to send the acknowledgement */
+  if (!redir_ipc_named)
+    return 0;
+
+  memset(&tv, 0, sizeof(tv));
+  tv.tv_sec = REDIR_IPC_TIMEOUT;
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  if (safe_recv(s, &ack, sizeof(ack), 0) != sizeof(ack)) {
+    log_err(errno, "chilli did not acknowledge message type %d", 
+	    (int) msg->mtype);
     return -1;
   }
 
-  shutdown(s, 2);
-  safe_close(s);
+  return 0;
+}
+
+/**
+ * redir_ipc_status()
+ * Asks chilli for the state of a client. Returns 0 with the state in
+ * conn, or -1 when chilli knows no such session or did not answer.
+ **/
+int redir_ipc_status(struct redir_msg_t *msg, struct redir_conn_t *conn) {
+  struct timeval tv;
+  int s;
+
+  redir_ipc_drain();
+
+  if ((s = redir_ipc_send(msg, 1)) < 0)
+    return -1;
+
+  memset(&tv, 0, sizeof(tv));
+  tv.tv_sec = REDIR_IPC_TIMEOUT;
+  setsockopt(s, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  /* An empty answer means no session */
+  if (safe_recv(s, conn, sizeof(*conn), 0) != sizeof(*conn))
+    return -1;
+
   return 0;
 }
 #endif
@@ -3139,6 +3685,10 @@ pid_t redir_fork(int in, int out) {
      */
     struct itimerval itval;
 
+#ifdef USING_IPC_UNIX
+    redir_ipc_reset();
+#endif
+
     set_signal(SIGALRM, redir_alarm);
 
     memset(&itval, 0, sizeof(itval));
@@ -3165,6 +3715,73 @@ pid_t redir_fork(int in, int out) {
   return pid;
 }
 
+/*
+ *  Serve a small file of local content in-process, framed with a
+ *  Content-Length so that the connection can be kept alive for the
+ *  rest of the portal's assets. Returns -1, leaving the file to the
+ *  forked path, when it is missing or larger than REDIR_WWW_INLINE.
+ */
+static int redir_wwwfile(struct redir_socket_t *sock, 
+			 char *filename, char *ctype) {
+  char path[1024];
+  struct stat st;
+  int gzip = 1;
+  bstring b;
+  int hlen;
+  int fd;
+
+  safe_snprintf(path, sizeof(path), "%s/%s.gz", _options.wwwdir, filename);
+
+  if ((fd = open(path, O_RDONLY)) < 0) {
+    gzip = 0;
+    safe_snprintf(path, sizeof(path), "%s/%s", _options.wwwdir, filename);
+    if ((fd = open(path, O_RDONLY)) < 0)
+      return -1;
+  }
+
+  if (fstat(fd, &st) || !S_ISREG(st.st_mode) || 
+      st.st_size > REDIR_WWW_INLINE) {
+    safe_close(fd);
+    return -1;
+  }
+
+  b = bfromcstralloc(st.st_size + 256, "");
+
+  bassignformat(b, 
+		"HTTP/1.1 200 OK\r\n%s"
+		"Connection: keep-alive\r\n"
+		"Content-Length: %ld\r\n"
+		"Content-type: %s\r\n\r\n", 
+		gzip ? "Content-Encoding: gzip\r\n" : "",
+		(long) st.st_size, ctype);
+
+  hlen = b->slen;
+  ballocmin(b, hlen + st.st_size + 1);
+
+  while (b->slen < hlen + st.st_size) {
+    ssize_t r = safe_read(fd, b->data + b->slen, 
+			  hlen + st.st_size - b->slen);
+    if (r <= 0) break;
+    b->slen += r;
+  }
+
+  safe_close(fd);
+
+  if (b->slen != hlen + st.st_size) {
+    /* changed under us */
+    bdestroy(b);
+    return -1;
+  }
+
+  if (redir_write(sock, (char *)b->data, b->slen) == b->slen)
+    sock->persist = 1;
+  else
+    log_err(errno, "redir_write()");
+
+  bdestroy(b);
+  return 0;
+}
+
 int redir_main(struct redir_t *redir, 
 	       int infd, int outfd, 
 	       struct sockaddr_in *address, 
@@ -3200,7 +3817,6 @@ int redir_main(struct redir_t *redir,
 
   int redir_main_exit() {
     /* if (httpreq->data_in) bdestroy(httpreq->data_in); */
-    /* if (!forked) return 0; XXXX*/
 #ifdef HAVE_SSL
     if (socket.sslcon) {
 #if(_debug_ > 1)
@@ -3214,7 +3830,22 @@ int redir_main(struct redir_t *redir,
     }
 #endif
     if (forked) _redir_close_exit(socket.fd[0], socket.fd[1]);
-    return _redir_close(socket.fd[0], socket.fd[1]);
+    /* Not forked, the caller owns and closes or keeps the socket */
+    if (rreq) rreq->keepalive = socket.persist;
+    return 0;
+  }
+
+  int redir_main_handoff() {
+    /* A child took the connection over, let go of it quietly */
+#ifdef HAVE_SSL
+    if (socket.sslcon) {
+      openssl_free(socket.sslcon);
+      socket.sslcon = 0;
+      if (rreq) 
+	rreq->sslcon = 0;
+    }
+#endif
+    return 0;
   }
 
 
@@ -3241,7 +3872,9 @@ int redir_main(struct redir_t *redir,
   memcpy(&msg.mdata.baddress, baddress, sizeof(msg.mdata.baddress)); \
   memcpy(&msg.mdata.params, &conn.s_params, sizeof(msg.mdata.params)); \
   memcpy(&msg.mdata.redir, &conn.s_state.redir, sizeof(msg.mdata.redir)); \
-  if (redir_send_msg(redir, &msg) < 0) { \
+  if (!forked && redir->cb_msg) { \
+    redir->cb_msg(&msg); \
+  } else if (redir_send_msg(redir, &msg) < 0) { \
     log_err(errno, "write() failed! msgfd=%d type=%d len=%d", redir->msgfd, msg.mtype, sizeof(msg.mdata)); \
     return redir_main_exit(); \
   } 
@@ -3252,7 +3885,9 @@ int redir_main(struct redir_t *redir,
   memcpy(&msg.mdata.baddress, baddress, sizeof(msg.mdata.baddress)); \
   memcpy(&msg.mdata.params, &conn.s_params, sizeof(msg.mdata.params)); \
   memcpy(&msg.mdata.redir, &conn.s_state.redir, sizeof(msg.mdata.redir)); \
-  if (msgsnd(redir->msgid, (void *)&msg, sizeof(msg.mdata), 0) < 0) { \
+  if (!forked && redir->cb_msg) { \
+    redir->cb_msg(&msg); \
+  } else if (msgsnd(redir->msgid, (void *)&msg, sizeof(msg.mdata), 0) < 0) { \
     log_err(errno, "msgsnd() failed! msgid=%d type=%d len=%d", redir->msgid, msg.mtype, sizeof(msg.mdata)); \
     return redir_main_exit(); \
   } 
@@ -3269,6 +3904,11 @@ int redir_main(struct redir_t *redir,
   socket.fd[0] = infd;
   socket.fd[1] = outfd;
 
+  if (rreq) {
+    socket.obuf = rreq->obuf;
+    rreq->keepalive = 0;
+  }
+
   redir->starttime = mainclock_now();
 
   /*
@@ -3391,6 +4031,24 @@ int redir_main(struct redir_t *redir,
 #if(_debug_ > 1)
   log_dbg("Processing HTTP%s Request", (conn.flags & USING_SSL) ? "S" : "");
 #endif
+
+  /* Only plain requests whose owner keeps the connection may persist */
+  socket.keepalive = (!forked && redir->keepalive && 
+		      httpreq.keepalive && !httpreq.is_post
+#ifdef HAVE_SSL
+		      && !socket.sslcon
+#endif
+		      );
+
+  if (conn.type == REDIR_PROBE) {
+    /* Answered from the cache, no session state needed */
+    termstate = REDIR_TERM_REPLY;
+    if (redir_write(&socket, (char *)redir->urltpl.probe->data, 
+		    redir->urltpl.probe->slen) < 0) {
+      log_err(errno, "redir_write()");
+    }
+    return redir_main_exit();
+  }
   
   switch (conn.type) {
 #ifdef ENABLE_EWTAPI
@@ -3467,15 +4125,22 @@ int redir_main(struct redir_t *redir,
 	  return redir_main_exit();
 	}
 	
+	if (!forked && !parse && socket.keepalive &&
+	    redir_wwwfile(&socket, filename, ctype) == 0)
+	  return redir_main_exit();
+
 	if (!forked) {
 	  /*
 	   *  If not forked off the main process already, fork now
 	   *  before doing the chroot(), chrdir(), and so on..
 	   */
 	  forkpid = redir_fork(infd, outfd);
-	  if (forkpid) { /* parent or error */
+	  if (forkpid > 0) /* parent */
+	    return redir_main_handoff();
+	  if (forkpid < 0) 
 	    return redir_main_exit();
-	  }
+	  forked = 1;
+	  socket.obuf = 0;
 	}
 	
 	if (parse) {
@@ -3763,9 +4428,12 @@ int redir_main(struct redir_t *redir,
 	 *  TODO: make redir_radius asynchronous.
 	 */
 	pid_t forkpid = redir_fork(infd, outfd);
-	if (forkpid) { /* parent or error */
+	if (forkpid > 0) /* parent */
+	  return redir_main_handoff();
+	if (forkpid < 0) 
 	  return redir_main_exit();
-	}
+	forked = 1;
+	socket.obuf = 0;
       }
 
 #ifdef ENABLE_MODULES
@@ -26,6 +26,7 @@
 #include "dhcp.h"
 #include "conn.h"
 #include "bstrlib.h"
+#include "md5.h"
 
 #define REDIR_TERM_INIT       0  /* Nothing done yet */
 #define REDIR_TERM_GETREQ     1  /* Before calling redir_getreq */
@@ -45,6 +46,7 @@
 #define REDIR_SPLASH          8
 #define REDIR_MACREAUTH       9
 #define REDIR_REQERROR       10  /* Used internally when the HTTP request parsing created an error */
+#define REDIR_PROBE          11  /* Well-known captive portal detection probe */
 
 #define REDIR_WWW            20
 #ifdef ENABLE_EWTAPI
@@ -159,6 +161,7 @@ struct redir_conn_t {
 struct redir_httpreq_t {
   char allow_post:1;
   char is_post:1;
+  char keepalive:1;      /* Client asked for a persistent connection */
 
   char host[256];
   char path[256];
@@ -184,6 +187,13 @@ typedef struct _redir_request {
   char gzip:1;
   char read_closed:1;
   char write_closed:1;
+  char keepalive:1;                 /* Idle after a reply, awaiting the next request */
+  char upstream_close:1;            /* Upstream closes after this response */
+  char head:1;                      /* Proxied request is a HEAD */
+
+  char chunk_state;                 /* Position in a chunked upstream body */
+  int chunk_left;
+  char inject_state;                /* Progress towards the injection point */
 
   int clen;
   
@@ -193,6 +203,8 @@ typedef struct _redir_request {
   bstring dbuf;
   bstring wbuf;
   bstring hbuf;
+  size_t hscan;                     /* Bytes of httpreq->data_in searched for the end of headers */
+  size_t hlen;                      /* Length of the header parsed from wbuf */
   bstring ibuf;
 
   time_t last_active;
@@ -200,6 +212,9 @@ typedef struct _redir_request {
   struct sockaddr_in baddr;
   
   struct conn_t conn;
+  char uhost[256];                  /* Upstream host, port and address proxied to */
+  int uport;
+  struct in_addr uaddr;
   
 #ifdef HAVE_SSL
   openssl_con *sslcon;
@@ -208,6 +223,7 @@ typedef struct _redir_request {
 
 #define REDIR_SOCKET_FD (1<<0)
 #define REDIR_CONN_FD   (1<<1)
+#define REDIR_CONN_DNS  (1<<2)
   char state;
 
 #ifdef ENABLE_REDIRINJECT
@@ -217,6 +233,9 @@ typedef struct _redir_request {
 
   struct _redir_request *prev, *next;
 
+  struct timer_node timer;          /* In-process redir timeout */
+  bstring obuf;                     /* In-process redir queued reply */
+
 } redir_request;
 
 struct redir_socket_t {
@@ -224,6 +243,29 @@ struct redir_socket_t {
 #ifdef HAVE_SSL
   openssl_con *sslcon;
 #endif
+  bstring obuf;                     /* Queue writes that would block */
+  char keepalive;                   /* Replies may leave the connection open */
+  char persist;                     /* A reply framed for keep-alive was sent */
+};
+
+#if defined(USING_POLL) && defined(HAVE_SYS_EPOLL_H)
+#define REDIR_POOL 1
+#endif
+
+struct redir_msg_t;
+
+/* Configuration dependent segments of the portal URL, url encoded
+ * once in redir_set() and spliced into each redirect. */
+struct redir_urltpl_t {
+  bstring uam;           /* &uamip=..&uamport=.. */
+  bstring called;        /* &called=.. */
+  bstring nas;           /* &ssid=..&nasid=.. */
+  bstring vlan;          /* &vlan=.. */
+  bstring ssl;           /* &ssl=.. */
+  bstring probe;         /* Complete reply to captive portal probes */
+  char *url;             /* URL the MD5 prefix state was taken for */
+  int mdlen;             /* Bytes of url (with separator) in mdctx */
+  MD5_CTX mdctx;
 };
 
 struct redir_t {
@@ -252,6 +294,10 @@ struct redir_t {
   struct in_addr radiuslisten;
 
   unsigned char nas_hwaddr[6];   /* Hardware address of NAS */
+
+  int keepalive;                 /* Owner holds connections open between requests */
+
+  struct redir_urltpl_t urltpl;
   
   int (*cb_getstate) (struct redir_t *redir, 
 		      struct sockaddr_in *address,
@@ -264,6 +310,9 @@ struct redir_t {
 			struct redir_socket_t *socket,
 			struct sockaddr_in *peer, 
 			redir_request *rreq);
+
+  /* Delivers messages in-process when not forked */
+  int (*cb_msg) (struct redir_msg_t *msg);
 };
 
 struct redir_msg_data {
@@ -291,6 +340,11 @@ void redir_set(struct redir_t *redir, uint8_t *hwaddr, int debug);
 
 int redir_accept(struct redir_t *redir, int idx);
 
+#ifdef REDIR_POOL
+int redir_pool_init();
+int redir_pool_run(struct redir_t *redir, int idx);
+#endif
+
 int redir_setchallenge(struct redir_t *redir, struct in_addr *addr, uint8_t *challenge);
 
 int redir_set_cb_getstate(struct redir_t *redir,
@@ -324,6 +378,11 @@ pid_t redir_fork(int in, int out);
 
 int redir_ipc(struct redir_t *redir);
 
+#ifdef USING_IPC_UNIX
+int redir_send_msg(struct redir_t *redir, struct redir_msg_t *msg);
+int redir_ipc_status(struct redir_msg_t *msg, struct redir_conn_t *conn);
+#endif
+
 
 int session_json_params(struct session_state *state,
 			struct session_params *params,
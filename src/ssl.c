@@ -50,6 +50,19 @@ openssl_env * initssl() {
   return sslenv_svr;
 }
 
+/*
+ *  The server context is set up by the parent before any redir
+ *  worker starts, and replaced only when options are reloaded.
+ */
+void reloadssl() {
+  if (sslenv_svr) {
+    openssl_env_free(sslenv_svr);
+    sslenv_svr = 0;
+  }
+  if (_options.uamuissl || _options.redirssl)
+    initssl();
+}
+
 openssl_env * initssl_cli() {
   if (sslenv_cli == 0) {
     if (openssl_init == 0) {
@@ -233,8 +246,32 @@ _openssl_env_init(openssl_env *env, char *engine, int server) {
 
   if (server) {
     SSL_CTX_set_options(env->ctx, SSL_OP_SINGLE_DH_USE);
-    SSL_CTX_set_session_cache_mode(env->ctx, SSL_SESS_CACHE_OFF);
     SSL_CTX_set_quiet_shutdown(env->ctx, 1);
+
+    /*
+     *  Session ids resume within the process holding the context,
+     *  which covers in-process redir workers. Forked workers share
+     *  the ticket keys generated here, so tickets resume in any.
+     */
+    SSL_CTX_set_session_cache_mode(env->ctx, SSL_SESS_CACHE_SERVER);
+#ifdef HAVE_OPENSSL_ENGINE
+    SSL_CTX_set_session_id_context(env->ctx, (unsigned char *)"chilli", 6);
+    SSL_CTX_sess_set_cache_size(env->ctx, REDIR_SSL_SESSIONS);
+    SSL_CTX_set_timeout(env->ctx, REDIR_SSL_SESSION_TIME);
+#endif
+#if defined(HAVE_OPENSSL_ENGINE) && defined(SSL_CTRL_SET_TLSEXT_TICKET_KEYS)
+    {
+      unsigned char keys[48];
+      if (RAND_bytes(keys, sizeof(keys)) == 1)
+	SSL_CTX_set_tlsext_ticket_keys(env->ctx, keys, sizeof(keys));
+      else
+	log_err(0, "could not generate TLS ticket keys");
+      OPENSSL_cleanse(keys, sizeof(keys));
+    }
+#endif
+#ifdef SSL_CTRL_SET_ECDH_AUTO
+    SSL_CTX_set_ecdh_auto(env->ctx, 1);
+#endif
   }
   return 1;
 }
@@ -251,7 +288,11 @@ static int _openssl_passwd(char *buf, int size, int rwflag, void *ud) {
 int
 openssl_env_init(openssl_env *env, char *engine, int server) {
 
-  if (!_options.sslcertfile || !_options.sslkeyfile) {
+  char rsa = _options.sslcertfile && _options.sslkeyfile;
+  char ecdsa = server && 
+    _options.sslecdsacertfile && _options.sslecdsakeyfile;
+
+  if (!rsa && !ecdsa) {
     log_err(0, "options sslcertfile and sslkeyfile are required");
     return 0;
   }
@@ -264,12 +305,21 @@ openssl_env_init(openssl_env *env, char *engine, int server) {
       SSL_CTX_set_default_passwd_cb(env->ctx, _openssl_passwd);
     }
     
-    if (!openssl_use_certificate(env, _options.sslcertfile) ||
-	!openssl_use_privatekey(env, _options.sslkeyfile)) {
+    if (rsa && 
+	(!openssl_use_certificate(env, _options.sslcertfile) ||
+	 !openssl_use_privatekey(env, _options.sslkeyfile))) {
       log_err(0, "failed reading setup sslcertfile and/or sslkeyfile");
       return 0;
     }
 
+    /* A second certificate, offered to clients preferring ECDSA */
+    if (ecdsa && 
+	(!openssl_use_certificate(env, _options.sslecdsacertfile) ||
+	 !openssl_use_privatekey(env, _options.sslecdsakeyfile))) {
+      log_err(0, "failed reading setup sslecdsacertfile and/or sslecdsakeyfile");
+      return 0;
+    }
+
     if (_options.sslcafile) {
       if (!openssl_cacert_location(env, _options.sslcafile, 0)) {
 	log_err(0, "failed reading sslcafile");
@@ -281,6 +331,12 @@ openssl_env_init(openssl_env *env, char *engine, int server) {
     return err;
   }
 #else
+  if (!rsa) {
+    log_err(0, "options sslcertfile and sslkeyfile are required");
+    return 0;
+  }
+  if (ecdsa) 
+    log_warn(0, "sslecdsacertfile is not supported with MatrixSSL");
   log_dbg("MatrixSSL Setup:");
   log_dbg("SSL cert: %s",_options.sslcertfile);
   log_dbg("SSL key: %s",_options.sslkeyfile);
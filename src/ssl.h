@@ -41,6 +41,7 @@ typedef struct {
 #include <openssl/ssl.h>
 #include <openssl/pem.h>
 #include <openssl/engine.h>
+#include <openssl/rand.h>
 #elif HAVE_CYASSL
 #include <stdio.h>
 #include <stdlib.h>
@@ -91,6 +92,7 @@ typedef struct {
 
 openssl_env * initssl();
 openssl_env * initssl_cli();
+void reloadssl();
 int openssl_verify_peer(openssl_env *env, int mode);
 int openssl_use_certificate(openssl_env *env, char *file);
 int openssl_use_privatekey(openssl_env *env, char *file);
@@ -89,7 +89,6 @@ int loadstatus() {
   while (fread(&dhcpconn, sizeof(struct dhcp_conn_t), 1, file) == 1) {
     struct dhcp_conn_t *conn = 0;
     struct ippoolm_t *newipm = 0;
-    int n;
 
     /* todo: read a md5 checksum or magic token */
 
@@ -110,10 +109,10 @@ int loadstatus() {
       dhcp_lnkconn(dhcp, &conn);
       
       /* set/copy all the pointers */
-      dhcpconn.nexthash = conn->nexthash;
       dhcpconn.next = conn->next;
       dhcpconn.prev = conn->prev;
       dhcpconn.parent = dhcp;
+      dhcpconn.leasetimer = conn->leasetimer;
 
       dhcpconn.is_reserved = 0; /* never a reserved ip if added here */
 
@@ -134,9 +133,7 @@ int loadstatus() {
       /* initialize dhcp_conn_t */
       memcpy(conn, &dhcpconn, sizeof(struct dhcp_conn_t));
       
-      for (n=0; n < DHCP_DNAT_MAX; n++) {
-	memset(conn->dnat[n].mac, 0, PKT_ETH_ALEN); 
-      }
+      conn->dnat = NULL;
       
       log_dbg("checking IP %s", inet_ntoa(dhcpconn.hisip));
 
@@ -151,6 +148,7 @@ int loadstatus() {
       }
       
       dhcp_hashadd(dhcp, conn);
+      dhcp_lease_timer(conn);
       
       if (conn->peer) {
 	conn->peer = 0;
@@ -169,6 +167,8 @@ int loadstatus() {
 	    appconn.unit = aconn->unit;
 	    appconn.next = aconn->next;
 	    appconn.prev = aconn->prev;
+	    appconn.timer = aconn->timer;
+	    appconn.idx = aconn->idx;
 	    appconn.uplink = newipm;
 	    appconn.dnlink = conn;
 	    
@@ -186,6 +186,7 @@ int loadstatus() {
 
 	    /* initialize app_conn_t */
 	    memcpy(aconn, &appconn, sizeof(struct app_conn_t));
+	    chilli_conn_reindex(aconn);
 	    conn->peer = aconn;
 
 	    if (newipm) {
@@ -250,6 +251,7 @@ int loadstatus() {
 	    
 	    memcpy(&aconn->s_params, &appconn.s_params, sizeof(struct session_params));
 	    memcpy(&aconn->s_state, &appconn.s_state, sizeof(struct session_state));
+	    chilli_conn_reindex(aconn);
 	    
 	  } else {
 	    /*
@@ -274,11 +276,14 @@ int loadstatus() {
 	      appconn.unit = aconn->unit;
 	      appconn.next = aconn->next;
 	      appconn.prev = aconn->prev;
+	      appconn.timer = aconn->timer;
+	      appconn.idx = aconn->idx;
 	      appconn.uplink = newipm;
 	      appconn.dnlink = conn;
 	      
 	      /* initialize app_conn_t */
 	      memcpy(aconn, &appconn, sizeof(struct app_conn_t));
+	      chilli_conn_reindex(aconn);
 	      conn->peer = aconn;
 	      newipm->peer = aconn;
 	      
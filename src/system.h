@@ -294,6 +294,38 @@ pid_t safe_fork();
     })
 #endif
 
+/*
+ * Hierarchical timing wheel with one second resolution. Each level has
+ * TIMER_WHEEL_SIZE slots; a timer sits in the lowest level that can
+ * hold it and moves down a level as its slot comes around. A timer is
+ * pending while its next pointer is set.
+ */
+#define TIMER_WHEEL_BITS    8
+#define TIMER_WHEEL_SIZE    (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK    (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS  3
+
+struct timer_node {
+  struct timer_node *next;
+  struct timer_node *prev;
+  time_t expires;
+  void (*cb)(struct timer_node *);
+};
+
+struct timer_wheel {
+  time_t now;
+  struct timer_node slot[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+};
+
+#define timer_pending(t) ((t)->next != NULL)
+#define timer_entry(t, type, member) \
+  ((type *)((char *)(t) - offsetof(type, member)))
+
+void timer_wheel_init(struct timer_wheel *w, time_t now);
+void timer_wheel_run(struct timer_wheel *w, time_t now);
+void timer_add(struct timer_wheel *w, struct timer_node *t, time_t expires);
+void timer_del(struct timer_node *t);
+
 #define SET_SA_FAMILY(addr, family)			\
     memset ((char *) &(addr), '\0', sizeof(addr));	\
     addr.sa_family = (family);
@@ -35,6 +35,10 @@
 extern struct rtmon_t _rtmon;
 #endif
 
+#if defined(__linux__) && !defined(IFF_NAPI)
+#define IFF_NAPI 0x0010
+#endif
+
 #define inaddr(x)    (((struct sockaddr_in *)&ifr->x)->sin_addr)
 #define inaddr2(p,x) (((struct sockaddr_in *)&(p)->x)->sin_addr)
 
@@ -524,6 +528,7 @@ int tun_setaddr(struct tun_t *this, struct in_addr *addr, struct in_addr *dstadd
 int tuntap_interface(struct _net_interface *netif) {
 #if defined(__linux__)
   struct ifreq ifr;
+  int ret;
 
 #elif defined(__FreeBSD__) || defined (__APPLE__) || defined (__OpenBSD__) || defined (__NetBSD__)
   char devname[IFNAMSIZ+5]; /* "/dev/" + ifname */
@@ -582,11 +587,30 @@ int tuntap_interface(struct _net_interface *netif) {
 #endif
     ;
 
+#ifdef IFF_MULTI_QUEUE
+  if (_options.tunqueues > 1)
+    ifr.ifr_flags |= IFF_MULTI_QUEUE;
+#endif
+
+  /* Have the kernel receive our writes through NAPI (and GRO) 
+   * instead of the per-packet netif_rx() backlog */
+  if (_options.tunnapi)
+    ifr.ifr_flags |= IFF_NAPI;
+
   if (_options.tundev && *_options.tundev && 
       strcmp(_options.tundev, "tap") && strcmp(_options.tundev, "tun"))
     safe_strncpy(ifr.ifr_name, _options.tundev, IFNAMSIZ);
 
-  if (ioctl(netif->fd, TUNSETIFF, (void *) &ifr) < 0) {
+  ret = ioctl(netif->fd, TUNSETIFF, (void *) &ifr);
+
+  if (ret < 0 && errno == EINVAL && (ifr.ifr_flags & IFF_NAPI)) {
+    /* Kernels before 4.15 reject flags they do not know about */
+    log_warn(0, "IFF_NAPI not supported, using the default tun receive path");
+    ifr.ifr_flags &= ~IFF_NAPI;
+    ret = ioctl(netif->fd, TUNSETIFF, (void *) &ifr);
+  }
+
+  if (ret < 0) {
     log_err(errno, "ioctl() failed");
     close(netif->fd);
     return -1;
@@ -740,6 +764,73 @@ int tuntap_interface(struct _net_interface *netif) {
 #endif
 }
 
+#if defined(__linux__)
+/*
+ * Attach the additional queues of the (IFF_MULTI_QUEUE) tun/tap
+ * interface. The kernel spreads the packets it routes to us over the
+ * queues by flow, and we pin each client to one queue when writing.
+ * All queues are still drained by the one main loop: this deepens
+ * the device's buffering and keeps each client on one queue, but it
+ * does not by itself spread the data plane over more cores.
+ */
+static void tun_open_queues(struct tun_t *tun) {
+  net_interface *netif = &tun(tun, 0);
+  int n = _options.tunqueues;
+  struct ifreq ifr;
+  int fd;
+
+  tun->qfd[0] = netif->fd;
+  tun->qcount = 1;
+
+  if (n > TUN_MAX_QUEUES) 
+    n = TUN_MAX_QUEUES;
+
+  if (n <= 1 || netif->fd <= 0) 
+    return;
+
+  memset(&ifr, 0, sizeof(ifr));
+  if (ioctl(netif->fd, TUNGETIFF, (void *) &ifr) < 0) {
+    log_err(errno, "ioctl(TUNGETIFF) failed");
+    return;
+  }
+
+  while (tun->qcount < n) {
+    if ((fd = open("/dev/net/tun", O_RDWR)) < 0) {
+      log_err(errno, "open() failed");
+      break;
+    }
+
+    if (ioctl(fd, TUNSETIFF, (void *) &ifr) < 0) {
+      log_err(errno, "ioctl() failed attaching queue %d to %s", 
+	      tun->qcount, netif->devname);
+      close(fd);
+      break;
+    }
+
+    ndelay_on(fd);
+    coe(fd);
+
+    tun->qfd[tun->qcount++] = fd;
+  }
+
+  log_info("Using %d queues on %s", tun->qcount, netif->devname);
+}
+
+static int tun_queue_fd(struct tun_t *tun, uint8_t *pack) {
+  uint32_t h = 0;
+
+  if (tun(tun, 0).flags & NET_ETHHDR) {
+    struct pkt_ethhdr_t *ethh = pkt_ethhdr(pack);
+    h = (ethh->src[4] << 8) | ethh->src[5];
+  } else if ((pack[0] >> 4) == 4) {
+    struct pkt_iphdr_t *iph = (struct pkt_iphdr_t *)pack;
+    h = ntohl(iph->saddr);
+  }
+
+  return tun->qfd[h % tun->qcount];
+}
+#endif
+
 int tun_new(struct tun_t **ptun) {
   struct tun_t *tun;
 
@@ -758,15 +849,27 @@ int tun_new(struct tun_t **ptun) {
   tuntap_interface(&tun->_tuntap);
 #endif
 
+#if defined(__linux__)
+  tun_open_queues(tun);
+#endif
+
   return 0;
 }
 
 int tun_free(struct tun_t *tun) {
+#if defined(__linux__)
+  int i;
+#endif
 
   if (tun->routes) {
     /*XXX: todo! net_delete_route(&tuntap(tun)); */
   }
 
+#if defined(__linux__)
+  for (i=1; i < tun->qcount; i++)
+    close(tun->qfd[i]);
+#endif
+
   tun_close(tun);
 
   /* TODO: For solaris we need to unlink streams */
@@ -953,6 +1056,20 @@ int tun_decaps(struct tun_t *this, int idx) {
 #endif
 }
 
+#if defined(__linux__)
+int tun_decaps_queue(struct tun_t *this, int q) {
+  struct tundecap c;
+  
+  c.this = this;
+  c.idx = 0;
+
+  if (net_read_dispatch_fd(this->qfd[q], tun_decaps_cb, &c) < 0)
+    return -1;
+
+  return 0;
+}
+#endif
+
 /*
 static uint32_t dnatip[1024];
 static uint16_t dnatport[1024];
@@ -985,6 +1102,11 @@ int tun_write(struct tun_t *tun, uint8_t *pack, size_t len, int idx) {
   }
 #endif
 
+#if defined(__linux__)
+  if (idx == 0 && tun->qcount > 1)
+    return safe_write(tun_queue_fd(tun, pack), pack, len);
+#endif
+
   return safe_write(tun(tun, idx).fd, pack, len);
 
 #elif defined (__sun__)
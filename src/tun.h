@@ -71,12 +71,21 @@ struct tun_t {
 #define tun_close(tun) net_close(&(tun)->_tuntap)
 #endif
 
+#if defined(__linux__)
+  /* Queues of a IFF_MULTI_QUEUE tun/tap; qfd[0] is the interface fd */
+  int qfd[TUN_MAX_QUEUES];
+  int qcount;
+#endif
+
   void *table;
 };
 
 int tun_new(struct tun_t **tun);
 int tun_free(struct tun_t *this);
 int tun_decaps(struct tun_t *this, int idx);
+#if defined(__linux__)
+int tun_decaps_queue(struct tun_t *this, int q);
+#endif
 int tun_encaps(struct tun_t *this, uint8_t *pack, size_t len, int idx);
 int tun_write(struct tun_t *tun, uint8_t *pack, size_t len, int idx);
 
@@ -194,3 +194,102 @@ getline (char** lineptr, size_t* n, FILE* stream) {
   }  
 }
 #endif
+
+void timer_wheel_init(struct timer_wheel *w, time_t now) {
+  int l, i;
+  w->now = now;
+  for (l = 0; l < TIMER_WHEEL_LEVELS; l++)
+    for (i = 0; i < TIMER_WHEEL_SIZE; i++)
+      w->slot[l][i].next = w->slot[l][i].prev = &w->slot[l][i];
+}
+
+void timer_del(struct timer_node *t) {
+  if (!timer_pending(t)) return;
+  t->next->prev = t->prev;
+  t->prev->next = t->next;
+  t->next = t->prev = NULL;
+}
+
+static void timer_link(struct timer_wheel *w, struct timer_node *t) {
+  time_t e = t->expires;
+  struct timer_node *head;
+  int l;
+
+  if (e <= w->now) {
+    /* overdue, run on the next tick */
+    head = &w->slot[0][(w->now + 1) & TIMER_WHEEL_MASK];
+  } else {
+    for (l = 0; l < TIMER_WHEEL_LEVELS - 1; l++) {
+      int shift = l * TIMER_WHEEL_BITS;
+      if ((e >> shift) - (w->now >> shift) < TIMER_WHEEL_SIZE)
+	break;
+    }
+    if (l == TIMER_WHEEL_LEVELS - 1) {
+      int shift = l * TIMER_WHEEL_BITS;
+      /* beyond the wheel, park in the furthest slot and re-file later */
+      if ((e >> shift) - (w->now >> shift) >= TIMER_WHEEL_SIZE)
+	e = ((w->now >> shift) + TIMER_WHEEL_MASK) << shift;
+    }
+    head = &w->slot[l][(e >> (l * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK];
+  }
+
+  t->next = head;
+  t->prev = head->prev;
+  head->prev->next = t;
+  head->prev = t;
+}
+
+void timer_add(struct timer_wheel *w, struct timer_node *t, time_t expires) {
+  timer_del(t);
+  t->expires = expires;
+  timer_link(w, t);
+}
+
+/* Moves the timers of one slot onto the levels below it */
+static void timer_cascade(struct timer_wheel *w, int l) {
+  struct timer_node *head = 
+    &w->slot[l][(w->now >> (l * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK];
+
+  while (head->next != head) {
+    struct timer_node *t = head->next;
+    timer_del(t);
+    if (t->expires == w->now) {
+      /* due in the tick being run */
+      struct timer_node *h = &w->slot[0][w->now & TIMER_WHEEL_MASK];
+      t->next = h;
+      t->prev = h->prev;
+      h->prev->next = t;
+      h->prev = t;
+    } else {
+      timer_link(w, t);
+    }
+  }
+}
+
+/**
+ * timer_wheel_run()
+ * Advances the wheel to now, calling back every timer that is due.
+ * Callbacks may add or delete timers, including their own.
+ **/
+void timer_wheel_run(struct timer_wheel *w, time_t now) {
+  while (w->now < now) {
+    struct timer_node *head;
+    int l;
+
+    w->now++;
+
+    for (l = TIMER_WHEEL_LEVELS - 1; l > 0; l--)
+      if (!(w->now & ((1 << (l * TIMER_WHEEL_BITS)) - 1)))
+	timer_cascade(w, l);
+
+    head = &w->slot[0][w->now & TIMER_WHEEL_MASK];
+    while (head->next != head) {
+      struct timer_node *t = head->next;
+      timer_del(t);
+      if (t->expires > w->now)
+	timer_link(w, t);
+      else if (t->cb)
+	t->cb(t);
+    }
+  }
+}